@@ -0,0 +1,12 @@
+Output throughput benchmark
+
+Prints the letter A just over four million times and nothing else so that
+nearly all of its run time is spent printing
+
+Run it with the verbose flag and send standard output to a pipe and then to a
+regular file to compare the output paths (the report at the end includes the
+output throughput)
+
+++++++++[>++++++++<-]>+
+>++++++++
+[>-[>-[<<<........>>>-]<-]<-]
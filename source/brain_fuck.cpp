@@ -23,46 +23,3896 @@ FALSE
 
 #include <vector>
 #include <map>
+#include <unordered_map>
+#include <deque>
+#include <sstream>
 #include <string>
 #include <iostream>
 #include <fstream>
 #include <chrono>
+#include <algorithm>
+#include <streambuf>
+#include <memory>
+#include <tuple>
+#include <atomic>
+#include <thread>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <cstring>
+#include <csignal>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/inotify.h>
+#include <dirent.h>
+#include <poll.h>
+#include <linux/perf_event.h>
 
 using namespace std;
 
+// Write a block of data out in full, retrying on partial writes and
+// interruptions
+bool write_all(int descriptor, const char *data, size_t size) {
+    while(size > 0) {
+        ssize_t written = write(descriptor, data, size);
+        if(written < 0) {
+            if(errno == EINTR)
+                continue;
+            return false;
+        }
+
+        data += written;
+        size -= written;
+    }
+
+    return true;
+}
+
+// A single-producer, single-consumer ring of bytes, drained to a file
+// descriptor by a dedicated writer thread -- so the thread running the
+// program never blocks in write(2), unless it gets far enough ahead to fill
+// the ring. The head is only ever advanced by the producer and the tail by
+// the writer, so no locks are needed
+class OutputRing {
+public:
+
+    // The capacity must be a power of two, so indices can be masked
+    explicit OutputRing(int descriptor, size_t capacity = 1 << 20) :
+            descriptor(descriptor), data(capacity), mask(capacity - 1),
+            writer(&OutputRing::run, this) {}
+
+    // Let the writer drain whatever is left, then stop it
+    ~OutputRing() {
+        stopping.store(true, memory_order_release);
+        writer.join();
+    }
+
+    // Copy a block into the ring, waiting for the writer to make space if the
+    // ring is full
+    void push(const char *block, size_t size) {
+        size_t position = head.load(memory_order_relaxed);
+
+        while(size > 0) {
+            size_t space = data.size() -
+                    (position - tail.load(memory_order_acquire));
+            if(space == 0) {
+                this_thread::yield();
+                continue;
+            }
+
+            size_t offset = position & mask;
+            size_t count = min({size, space, data.size() - offset});
+            copy(block, block + count, data.begin() + offset);
+            block += count;
+            size -= count;
+            position += count;
+            head.store(position, memory_order_release);
+        }
+    }
+
+    // Block until everything pushed so far has been written out. Returns
+    // false if the writer has hit an error
+    bool wait() {
+        size_t position = head.load(memory_order_relaxed);
+        while(tail.load(memory_order_acquire) != position &&
+                !failed.load(memory_order_acquire))
+            this_thread::yield();
+
+        return !failed.load(memory_order_acquire);
+    }
+
+private:
+
+    // The writer thread: write out whatever lies between the tail and the
+    // head, backing off to short sleeps while the ring stays empty
+    void run() {
+        int idle_rounds = 0;
+
+        while(true) {
+            size_t position = tail.load(memory_order_relaxed);
+            size_t end = head.load(memory_order_acquire);
+
+            if(position == end) {
+                if(stopping.load(memory_order_acquire) &&
+                        head.load(memory_order_acquire) == position)
+                    return;
+
+                if(++ idle_rounds < 64)
+                    this_thread::yield();
+                else
+                    this_thread::sleep_for(chrono::microseconds(100));
+                continue;
+            }
+
+            idle_rounds = 0;
+            size_t offset = position & mask;
+            size_t count = min(end - position, data.size() - offset);
+
+            // After an error, keep consuming (and discarding) so the
+            // producer can never deadlock on a full ring
+            if(!failed.load(memory_order_relaxed) &&
+                    !write_all(descriptor, &data[offset], count))
+                failed.store(true, memory_order_release);
+
+            tail.store(position + count, memory_order_release);
+        }
+    }
+
+    int descriptor;
+    vector<char> data;
+    size_t mask;
+    atomic<size_t> head{0};
+    atomic<size_t> tail{0};
+    atomic<bool> stopping{false};
+    atomic<bool> failed{false};
+    thread writer;
+};
+
+// A stream buffer which collects everything written to standard output, and
+// hands it to the operating system in large blocks. Printing a character
+// through cout costs a library call (and, when the terminal is line buffered,
+// sometimes a system call) per character -- which dominates the run time of
+// output-heavy programs.
+//
+// How full blocks leave depends on what standard output is:
+//  - a pipe: the pages themselves are handed to the kernel with vmsplice(2),
+//    so the output is never copied. There are two buffers, each as large as
+//    the pipe, and a buffer is only refilled once the other has been spliced
+//    in full -- at which point the pipe can't still be holding its pages
+//  - a regular file: one buffer fills while the other waits, and both go out
+//    in a single writev(2)
+//  - anything else (usually a terminal): plain write(2)
+class OutputBuffer : public streambuf {
+public:
+    explicit OutputBuffer(int descriptor, size_t capacity = 1 << 16) :
+            descriptor(descriptor) {
+        struct stat status;
+        if(fstat(descriptor, &status) == 0) {
+            if(S_ISFIFO(status.st_mode)) {
+                sink = Sink::Splice;
+                int pipe_size = fcntl(descriptor, F_GETPIPE_SZ);
+                if(pipe_size > 0)
+                    capacity = max(capacity, size_t(pipe_size));
+            }
+            else if(S_ISREG(status.st_mode))
+                sink = Sink::Gather;
+        }
+
+        // Whole pages, so that spliced buffers map cleanly onto pipe pages
+        size_t page_size = sysconf(_SC_PAGESIZE);
+        capacity = (capacity + page_size - 1) / page_size * page_size;
+        for(auto &buffer : buffers) {
+            void *memory = mmap(nullptr, capacity, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if(memory == MAP_FAILED)
+                throw bad_alloc();
+            buffer = static_cast<char *>(memory);
+        }
+
+        buffer_size = capacity;
+        setp(buffers[0], buffers[0] + buffer_size);
+    }
+
+    ~OutputBuffer() {
+        for(auto buffer : buffers)
+            munmap(buffer, buffer_size);
+    }
+
+    // Hand full buffers to a writer thread, rather than writing them directly
+    // (pass null to go back to direct writes)
+    void set_ring(OutputRing *output_ring) {
+        drain();
+        ring = output_ring;
+    }
+
+protected:
+
+    // Called when the buffer is full
+    int overflow(int character) override {
+        if(hand_off() == -1)
+            return traits_type::eof();
+
+        if(character != traits_type::eof()) {
+            *pptr() = character;
+            pbump(1);
+        }
+
+        return traits_type::not_eof(character);
+    }
+
+    // Called when the stream is flushed (by endl, or before cin and cerr are
+    // used, since they're tied to cout). With a writer thread, this is a
+    // synchronous flush -- so prompts are on screen before input is read
+    int sync() override {
+        if(drain() == -1)
+            return -1;
+
+        if(ring && !ring->wait())
+            return -1;
+
+        return 0;
+    }
+
+private:
+    enum class Sink { Write, Gather, Splice };
+
+    // Pass on a full buffer, and switch to the other one
+    int hand_off() {
+        size_t size = pptr() - pbase();
+        bool written = true;
+
+        if(ring)
+            ring->push(pbase(), size);
+
+        else if(sink == Sink::Splice)
+            written = splice_all(pbase(), size);
+
+        // Hold on to the first full buffer, and write both out together once
+        // the second fills
+        else if(sink == Sink::Gather) {
+            if(pending_size == 0) {
+                pending_size = size;
+                swap_buffers();
+                return 0;
+            }
+
+            written = write_pending(pbase(), size);
+        }
+
+        else
+            written = write_all(descriptor, pbase(), size);
+
+        swap_buffers();
+        return written ? 0 : -1;
+    }
+
+    // Pass on everything buffered so far. A partly filled buffer is copied
+    // rather than spliced, since it'll be refilled straight away
+    int drain() {
+        size_t size = pptr() - pbase();
+        bool written = true;
+
+        if(ring)
+            ring->push(pbase(), size);
+        else if(pending_size > 0)
+            written = write_pending(pbase(), size);
+        else
+            written = write_all(descriptor, pbase(), size);
+
+        setp(pbase(), pbase() + buffer_size);
+        return written ? 0 : -1;
+    }
+
+    // Write the buffer waiting from a previous hand-off, followed by the given
+    // block, in a single system call (where possible)
+    bool write_pending(char *block, size_t size) {
+        char *pending = buffers[block == buffers[0]];
+        iovec vectors[2] = {{pending, pending_size}, {block, size}};
+        pending_size = 0;
+
+        iovec *vector = vectors;
+        int count = 2;
+        while(count > 0) {
+            ssize_t written = writev(descriptor, vector, count);
+            if(written < 0) {
+                if(errno == EINTR)
+                    continue;
+                return false;
+            }
+
+            // Skip past whatever was written, in case it was a partial write
+            while(count > 0 && size_t(written) >= vector->iov_len) {
+                written -= vector->iov_len;
+                vector += 1;
+                count -= 1;
+            }
+            if(count > 0) {
+                vector->iov_base = static_cast<char *>(vector->iov_base) +
+                        written;
+                vector->iov_len -= written;
+            }
+        }
+
+        return true;
+    }
+
+    // Give a full buffer's pages to the pipe. If the kernel won't splice to
+    // this descriptor, fall back to plain writes from here on
+    bool splice_all(char *block, size_t size) {
+        while(size > 0) {
+            iovec vector = {block, size};
+            ssize_t spliced = vmsplice(descriptor, &vector, 1, 0);
+            if(spliced < 0) {
+                if(errno == EINTR)
+                    continue;
+                if(errno == EINVAL || errno == ENOSYS || errno == EBADF) {
+                    sink = Sink::Write;
+                    return write_all(descriptor, block, size);
+                }
+                return false;
+            }
+
+            block += spliced;
+            size -= spliced;
+        }
+
+        return true;
+    }
+
+    void swap_buffers() {
+        char *next = buffers[pbase() == buffers[0]];
+        setp(next, next + buffer_size);
+    }
+
+    int descriptor;
+    Sink sink = Sink::Write;
+    char *buffers[2];
+    size_t buffer_size;
+    size_t pending_size = 0;
+    OutputRing *ring = nullptr;
+};
+
+// Output passed on to another buffer, with a copy kept as it goes -- up to a
+// limit, past which the copy's given up
+class CopyingBuffer : public streambuf {
+public:
+    CopyingBuffer(streambuf *destination, size_t limit) :
+            destination(destination), limit(limit) {
+        setp(buffer, buffer + sizeof buffer);
+    }
+
+    ~CopyingBuffer() {
+        sync();
+    }
+
+    string copy;
+    bool complete = true;
+
+protected:
+    int overflow(int character) override {
+        if(sync() == -1)
+            return traits_type::eof();
+
+        if(character != traits_type::eof()) {
+            *pptr() = character;
+            pbump(1);
+        }
+
+        return traits_type::not_eof(character);
+    }
+
+    int sync() override {
+        size_t size = pptr() - pbase();
+        if(complete && copy.size() + size <= limit)
+            copy.append(pbase(), size);
+        else if(complete) {
+            complete = false;
+            string().swap(copy);
+        }
+
+        streamsize passed = destination->sputn(pbase(), size);
+        setp(buffer, buffer + sizeof buffer);
+        return passed == streamsize(size) ? 0 : -1;
+    }
+
+private:
+    streambuf *destination;
+    size_t limit;
+    char buffer[1 << 16];
+};
+
+// Program input read from a file, which is mapped into memory rather than
+// streamed -- so that handing a byte to ',' is a pointer bump and an end of
+// file comparison, with no library call. Anything which can't be mapped (a
+// pipe, a terminal, or a file which doesn't know its size, like those in
+// /proc) is read into memory up front instead
+class MappedInput {
+public:
+    explicit MappedInput(const string &file_name) {
+        int descriptor = open(file_name.c_str(), O_RDONLY);
+        struct stat status;
+        if(descriptor == -1 || fstat(descriptor, &status) == -1) {
+            cerr << "Couldn't open input file: " << file_name;
+            if(descriptor != -1)
+                close(descriptor);
+            throw -1;
+        }
+
+        if(!S_ISREG(status.st_mode) || status.st_size == 0) {
+            read_all(descriptor, file_name);
+            close(descriptor);
+            return;
+        }
+
+        size = status.st_size;
+        mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+        if(mapping == MAP_FAILED) {
+            cerr << "Couldn't map input file: " << file_name;
+            close(descriptor);
+            throw -1;
+        }
+
+        madvise(mapping, size, MADV_SEQUENTIAL);
+        begin = static_cast<const char *>(mapping);
+        close(descriptor);
+    }
+
+    ~MappedInput() {
+        if(mapping)
+            munmap(mapping, size);
+    }
+
+    // The mapped bytes -- the interpreter keeps its own cursor into these
+    const char *begin = nullptr;
+    size_t size = 0;
+
+private:
+    void read_all(int descriptor, const string &file_name) {
+        char chunk[1 << 16];
+        while(true) {
+            ssize_t count = read(descriptor, chunk, sizeof chunk);
+            if(count < 0 && errno == EINTR)
+                continue;
+            if(count < 0) {
+                cerr << "Couldn't read input file: " << file_name;
+                close(descriptor);
+                throw -1;
+            }
+            if(count == 0)
+                break;
+            contents.append(chunk, count);
+        }
+
+        begin = contents.data();
+        size = contents.size();
+    }
+
+    void *mapping = nullptr;
+    string contents;
+};
+
 // Count the number of brainfuck operators in a given instruction set
 int count_operators(string instructions) {
     string operators = "+-./<>[]";
     int operator_count = 0;
 
-    for(auto instruction : instructions) {
-        if(operators.find(instruction) != string::npos)
-            operator_count += 1;
+    for(auto instruction : instructions) {
+        if(operators.find(instruction) != string::npos)
+            operator_count += 1;
+    }
+
+    return operator_count;
+}
+
+// Get input, with some error checking (marked cold, as it waits on the user
+// anyway)
+__attribute__((cold)) char get_input() {
+    cout << endl << "> ";
+
+    string input;
+    getline(cin, input);
+
+    if(!cin.good())
+        throw -1;
+
+    else if(input.empty()) {
+        cerr << "Input error";
+        throw -1;
+    }
+
+    return input[0];
+}
+
+// Keys as they're pressed, for interactive programs (games, and the like)
+// which want each one straight away, rather than a line at a time. The
+// terminal's taken out of canonical mode, with its echo off, until the run
+// ends -- or until a signal ends it, when the handler puts it back first
+class RawTerminal {
+public:
+    RawTerminal() {
+        if(!isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &saved) == -1) {
+            cerr << "Raw input needs a terminal";
+            throw -1;
+        }
+
+        struct sigaction action = {};
+        action.sa_handler = restore_and_raise;
+        for(int index = 0; index < signal_count; index += 1)
+            sigaction(signals[index], &action, &previous[index]);
+
+        termios raw = saved;
+        raw.c_lflag &= ~(ICANON | ECHO);
+        raw.c_cc[VMIN] = 1;
+        raw.c_cc[VTIME] = 0;
+        tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+    }
+
+    ~RawTerminal() {
+        tcsetattr(STDIN_FILENO, TCSANOW, &saved);
+        for(int index = 0; index < signal_count; index += 1)
+            sigaction(signals[index], &previous[index], nullptr);
+    }
+
+    // Wait for the next key, with everything printed so far on screen first
+    __attribute__((cold)) char get_key() {
+        cout.flush();
+
+        char key;
+        ssize_t got;
+        do
+            got = read(STDIN_FILENO, &key, 1);
+        while(got < 0 && errno == EINTR);
+
+        if(got != 1)
+            throw -1;
+        return key;
+    }
+
+private:
+    // Put the terminal back, then let the signal do what it would have
+    static void restore_and_raise(int signal) {
+        tcsetattr(STDIN_FILENO, TCSANOW, &saved);
+        ::signal(signal, SIG_DFL);
+        raise(signal);
+    }
+
+    static constexpr int signal_count = 4;
+    static constexpr int signals[signal_count] = {
+        SIGINT, SIGTERM, SIGHUP, SIGQUIT
+    };
+
+    static termios saved;
+    struct sigaction previous[signal_count];
+};
+
+termios RawTerminal::saved;
+
+// A log of the bytes typed in answer to ',', so an interactive run can be
+// replayed exactly, with no terminal, through the same path as an input
+// file. Each byte is a line: the microseconds since the run started, the
+// number of characters printed before its prompt, and the byte
+class InputRecording {
+public:
+    explicit InputRecording(const string &file_name) : file(file_name) {
+        if(!file.is_open()) {
+            cerr << "Couldn't open recording file: " << file_name;
+            throw -1;
+        }
+    }
+
+    // Each byte's written as it comes (at typing speed, that costs nothing),
+    // so a run ended by a signal keeps its recording
+    void record(char value, long position) {
+        chrono::duration<double, micro> elapsed =
+                chrono::steady_clock::now() - start;
+        file << long(elapsed.count()) << ' ' << position << ' ' <<
+                int((unsigned char)value) << '\n';
+        file.flush();
+    }
+
+    // The bytes of a recording, in the order they were typed
+    static string replay(const string &file_name) {
+        ifstream file(file_name);
+        if(!file.is_open()) {
+            cerr << "Couldn't open recording file: " << file_name;
+            throw -1;
+        }
+
+        string bytes;
+        long time, position;
+        int value;
+        while(file >> time >> position >> value)
+            bytes += char(value);
+
+        if(!file.eof()) {
+            cerr << "Recording file malformed: " << file_name;
+            throw -1;
+        }
+        return bytes;
+    }
+
+private:
+    ofstream file;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+};
+
+// The operations which brainfuck instructions are translated into before
+// they're run. Runs of adds or shifts in one direction become a single
+// operation, runs of input and output over consecutive cells are gathered
+// into block operations, and the [-] idiom becomes a set
+enum class Code {
+    Add,        // Add the value to the current cell (+ and -)
+    Move,       // Move the pointer by the value (> and <)
+    Print,      // Print the current cell (.)
+    Read,       // Read into the current cell (,)
+    Loop,       // Run the body while the current cell is non-zero ([ and ]).
+                // The value is 1 when the cell's known to be non-zero on
+                // entry, so the test there can be skipped, or -1 when it's
+                // known to be zero (the loop is dead, and its body empty)
+    ReadBlock,  // Read into `value` consecutive cells, from the pointer plus
+                // the offset (,>,>,)
+    WriteBlock, // Print `value` consecutive cells, from the pointer plus the
+                // offset (.>.>.)
+    Set         // Set the current cell to the value ([-], and any adds in
+                // one direction after it)
+};
+
+// Loops are parsed lazily: until a loop is first entered, its body is left as
+// the instructions between the two pointers (with the brackets' matches from
+// the third), and parsed when it's needed (so the body is a cache, filled in
+// by engines which only hold the program as const). The pointers are kept, so
+// a body can be dropped and parsed again (see CodeCache, which notes where it
+// holds the body). Bodies are shared, so identical loops can use the same one
+struct Operation {
+    Operation(Code code, int value = 0, int offset = 0) :
+            code(code), value(value), offset(offset) {}
+
+    Code code;
+    int value;
+    int offset;
+    mutable int cache_entry = -1;
+    mutable shared_ptr<const vector<Operation>> body;
+    mutable const char *unparsed_begin = nullptr;
+    mutable const char *unparsed_end = nullptr;
+    mutable const int *unparsed_matches = nullptr;
+};
+
+// The number of operators an operation stands for, each counted as an
+// operation when it's performed. A loop's is the test on entry (each test at
+// the end of its body counts as well), and a set's is the test on entry to
+// its [-] plus the adds after it (each pass of the [-] counts two more). A
+// block counts its reads or prints -- the shifts between them are counted by
+// the move after it
+inline int weight(const Operation &operation) {
+    switch(operation.code) {
+        case Code::Add:
+        case Code::Move:
+            return abs(operation.value);
+
+        case Code::Set:
+            return 1 + abs(operation.value);
+
+        case Code::ReadBlock:
+        case Code::WriteBlock:
+            return operation.value;
+
+        default:
+            return 1;
+    }
+}
+
+void gather_blocks(vector<Operation> &block);
+void canonicalize(vector<Operation> &block);
+
+// The deepest loops can be nested. Parsing, running and every pass over a
+// program recurse into each loop's body, so the nesting has to be limited to
+// keep within the stack (the wide engine, the hungriest, takes about 1KB a
+// level)
+constexpr long max_nesting = 4096;
+
+[[noreturn]] void nesting_exceeded() {
+    cerr << "Loops nested more than " << max_nesting << " deep";
+    throw -1;
+}
+
+// Check the brackets match, before anything's parsed (this is the only pass
+// over the whole program made up front). Each bracket's match is found on the
+// way: the distance from each [ to its ] is noted at the [, so parsing can
+// jump straight to the end of a loop
+vector<int> match_brackets(const char *begin, const char *end) {
+    vector<int> matches(end - begin);
+    vector<int> open;
+
+    for(const char *instruction = begin; instruction < end; instruction += 1) {
+        if(*instruction == '[') {
+            if(long(open.size()) == max_nesting)
+                nesting_exceeded();
+            open.push_back(instruction - begin);
+        }
+        else if(*instruction == ']') {
+            if(open.empty()) {
+                cerr << "Syntax error";
+                throw -1;
+            }
+            matches[open.back()] = instruction - begin - open.back();
+            open.pop_back();
+        }
+    }
+
+    if(!open.empty()) {
+        cerr << "Syntax error";
+        throw -1;
+    }
+
+    return matches;
+}
+
+// Translate a run of instructions (with matching brackets, whose matches are
+// given for each position in the run) into operations. Loops are skipped over
+// rather than parsed, and their bodies noted for later
+vector<Operation> parse_range(const char *begin, const char *end,
+        const int *matches) {
+    vector<Operation> block;
+
+    for(const char *instruction = begin; instruction < end; instruction += 1) {
+        if(*instruction == '+')
+            block.push_back({Code::Add, 1});
+        else if(*instruction == '-')
+            block.push_back({Code::Add, -1});
+        else if(*instruction == '>')
+            block.push_back({Code::Move, 1});
+        else if(*instruction == '<')
+            block.push_back({Code::Move, -1});
+        else if(*instruction == '.')
+            block.push_back({Code::Print});
+        else if(*instruction == ',')
+            block.push_back({Code::Read});
+
+        // Carry on from the matching bracket
+        else if(*instruction == '[') {
+            Operation loop = {Code::Loop};
+            loop.unparsed_begin = instruction + 1;
+            loop.unparsed_matches = matches + (instruction - begin) + 1;
+            instruction += matches[instruction - begin];
+            loop.unparsed_end = instruction;
+            block.push_back(move(loop));
+        }
+    }
+
+    gather_blocks(block);
+    canonicalize(block);
+    return block;
+}
+
+// Parse a loop's body, the first time it's needed
+inline void parse_body(const Operation &loop) {
+    if(!loop.body) {
+        loop.body = make_shared<const vector<Operation>>(
+                parse_range(loop.unparsed_begin, loop.unparsed_end,
+                loop.unparsed_matches));
+    }
+}
+
+// Parse every loop in a block, for the engines and passes which need to see
+// the whole program
+void parse_all(const vector<Operation> &block) {
+    for(const Operation &operation : block) {
+        if(operation.code == Code::Loop) {
+            parse_body(operation);
+            parse_all(*operation.body);
+        }
+    }
+}
+
+// Run a task for every index below the count, spread across the machine's
+// cores. Indices are handed out one at a time from an atomic counter, so
+// threads which get through their work quickly take on more
+template<typename Task>
+void parallel_for(size_t count, const Task &task) {
+    size_t thread_count = min<size_t>(count,
+            max(1u, thread::hardware_concurrency()));
+    atomic<size_t> next(0);
+
+    auto work = [&]() {
+        for(size_t index = next++; index < count; index = next++)
+            task(index);
+    };
+
+    vector<thread> threads;
+    for(size_t thread_index = 1; thread_index < thread_count;
+            thread_index += 1)
+        threads.emplace_back(work);
+
+    work();
+    for(thread &worker : threads)
+        worker.join();
+}
+
+// Parse every loop in the program, with the top-level loops spread across
+// threads. Each top-level loop's subtree is independent of the others, so
+// the result is the same as parsing them one after another
+void parse_all_parallel(const vector<Operation> &program) {
+    vector<const Operation *> loops;
+    for(const Operation &operation : program) {
+        if(operation.code == Code::Loop)
+            loops.push_back(&operation);
+    }
+
+    parallel_for(loops.size(), [&](size_t index) {
+        parse_body(*loops[index]);
+        parse_all(*loops[index]->body);
+    });
+}
+
+// Hash-consing of loop bodies: structurally identical bodies are replaced by
+// one shared copy, so generated programs (which repeat the same loops over
+// and over) hold each distinct loop once. Bodies are interned from the
+// innermost out, so when two bodies are compared their own loops have been
+// interned already -- and comparing those is a matter of comparing pointers
+class BodyTable {
+public:
+
+    // Room for the given number of distinct bodies is made up front, as
+    // growing the tables is much of the cost on large programs
+    explicit BodyTable(size_t loops) {
+        bodies.reserve(loops);
+        hashes.reserve(loops);
+    }
+
+    void intern(const vector<Operation> &block) {
+        for(const Operation &operation : block) {
+            if(operation.code != Code::Loop ||
+                    hashes.count(operation.body.get()))
+                continue;
+
+            intern(*operation.body);
+
+            uint64_t hash = hash_block(*operation.body);
+            auto matches = bodies.equal_range(hash);
+            auto match = matches.first;
+            while(match != matches.second &&
+                    !same_block(*match->second, *operation.body))
+                ++ match;
+
+            if(match != matches.second)
+                operation.body = match->second;
+            else {
+                bodies.emplace(hash, operation.body);
+                hashes[operation.body.get()] = hash;
+            }
+        }
+    }
+
+private:
+
+    // 64-bit FNV-1a, over each operation's fields (and the hash of each
+    // loop's body, which has been interned already)
+    uint64_t hash_block(const vector<Operation> &block) {
+        uint64_t hash = 14695981039346656037ull;
+        for(const Operation &operation : block) {
+            uint64_t fields[] = {uint64_t(operation.code),
+                    uint64_t(operation.value), uint64_t(operation.offset),
+                    operation.code == Code::Loop ?
+                    hashes[operation.body.get()] : 0};
+            for(uint64_t field : fields) {
+                hash ^= field;
+                hash *= 1099511628211ull;
+            }
+        }
+
+        return hash;
+    }
+
+    static bool same_block(const vector<Operation> &first,
+            const vector<Operation> &second) {
+        if(first.size() != second.size())
+            return false;
+
+        for(size_t index = 0; index < first.size(); index += 1) {
+            const Operation &one = first[index];
+            const Operation &other = second[index];
+            if(one.code != other.code || one.value != other.value ||
+                    one.offset != other.offset || one.body != other.body)
+                return false;
+        }
+
+        return true;
+    }
+
+    // Each distinct body (held, so a table can be kept from one version of a
+    // program to the next, as the bodies it knows are replaced)
+    unordered_multimap<uint64_t, shared_ptr<const vector<Operation>>> bodies;
+    unordered_map<const vector<Operation> *, uint64_t> hashes;
+};
+
+// Share identical loop bodies throughout a (fully parsed) program, which has
+// at most the given number of loops
+void intern_loops(const vector<Operation> &program, size_t loops) {
+    BodyTable(loops).intern(program);
+}
+
+// Translate the instructions into operations, checking the brackets match.
+// Only the top level is parsed -- loops are parsed as they're entered, using
+// the brackets' matches (which are kept as long as the program is)
+vector<Operation> parse(const string &instructions, vector<int> &matches) {
+    const char *begin = instructions.data();
+    const char *end = begin + instructions.size();
+    matches = match_brackets(begin, end);
+    return parse_range(begin, end, matches.data());
+}
+
+// Gather runs of reads or prints separated by single right shifts (,>,>, and
+// .>.>.) into block operations, which move the whole run in one go. The shifts
+// between the cells become a single move after the block. Loop bodies are
+// gathered as they're parsed
+void gather_blocks(vector<Operation> &block) {
+    vector<Operation> gathered;
+
+    for(size_t index = 0; index < block.size(); index += 1) {
+        Operation &operation = block[index];
+
+        if(operation.code != Code::Read && operation.code != Code::Print) {
+            gathered.push_back(move(operation));
+            continue;
+        }
+
+        // Count how many cells the run covers
+        int count = 1;
+        while(index + 2 * count < block.size() &&
+                block[index + 2 * count - 1].code == Code::Move &&
+                block[index + 2 * count - 1].value == 1 &&
+                block[index + 2 * count].code == operation.code)
+            count += 1;
+
+        if(count == 1) {
+            gathered.push_back(move(operation));
+            continue;
+        }
+
+        Code code = operation.code == Code::Read ? Code::ReadBlock :
+                Code::WriteBlock;
+        gathered.push_back({code, count, 0});
+        gathered.push_back({Code::Move, count - 1});
+        index += 2 * (count - 1);
+    }
+
+    block = move(gathered);
+}
+
+// Whether a loop, not yet parsed, is the [-] idiom (ignoring comments)
+bool is_clear_loop(const Operation &loop) {
+    int decrements = 0;
+
+    for(const char *instruction = loop.unparsed_begin;
+            instruction < loop.unparsed_end; instruction += 1) {
+        if(*instruction == '-')
+            decrements += 1;
+        else if(string("+<>.,[]").find(*instruction) != string::npos)
+            return false;
+    }
+
+    return decrements == 1;
+}
+
+// Canonicalize a freshly parsed block, so every engine runs fewer operations
+// (and tests fewer branches):
+//  - runs of adds, or of shifts, in one direction are merged
+//  - [-] becomes a set, taking in any adds after it
+//  - a loop right after another loop, or after setting the cell to zero, can
+//    never be entered, so its body is dropped
+//  - a loop right after setting the cell to 1 to 255 is always entered, so
+//    its test on entry is skipped (every loop is already run as a do-while
+//    behind that single test). Sets beyond that range are left to test the
+//    cell, as what they leave depends on the overflow policy
+// The operations performed are still counted operator by operator (see
+// weight above), so the counts don't change
+void canonicalize(vector<Operation> &block) {
+    vector<Operation> canonical;
+
+    for(Operation &operation : block) {
+        Operation *last = canonical.empty() ? nullptr : &canonical.back();
+
+        if(operation.code == Code::Add && last &&
+                (last->code == Code::Add || last->code == Code::Set) &&
+                (last->value == 0 ||
+                (last->value > 0) == (operation.value > 0)))
+            last->value += operation.value;
+        else if(operation.code == Code::Move && last &&
+                last->code == Code::Move &&
+                (last->value > 0) == (operation.value > 0))
+            last->value += operation.value;
+        else if(operation.code == Code::Loop && !operation.body &&
+                is_clear_loop(operation))
+            canonical.push_back({Code::Set, 0});
+        else if(operation.code == Code::Loop && last &&
+                (last->code == Code::Loop ||
+                (last->code == Code::Set && last->value == 0))) {
+            Operation dead = {Code::Loop, -1};
+            dead.body = make_shared<const vector<Operation>>();
+            canonical.push_back(move(dead));
+        }
+        else {
+            if(operation.code == Code::Loop && last &&
+                    last->code == Code::Set && last->value > 0 &&
+                    last->value < 256)
+                operation.value = 1;
+            canonical.push_back(move(operation));
+        }
+    }
+
+    block = move(canonical);
+}
+
+constexpr size_t huge_page_size = 2 << 20;
+
+// Map a region of zeroed memory, of at least the given size (which is updated
+// to the size mapped). With huge pages, the region is backed by explicitly
+// reserved huge pages (MAP_HUGETLB) where the system has any, and otherwise
+// aligned to a huge page and left to the kernel to back with transparent
+// ones. The backing is set to say which it got
+char *map_region(size_t &size, bool huge_pages, const char *&backing) {
+    int protection = PROT_READ | PROT_WRITE;
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+    backing = "normal";
+
+    if(!huge_pages) {
+        void *region = mmap(nullptr, size, protection, flags, -1, 0);
+        return region == MAP_FAILED ? nullptr : static_cast<char *>(region);
+    }
+
+    // Reserved huge pages are claimed up front (without MAP_NORESERVE), so
+    // the mapping fails, rather than faulting later, when there aren't enough
+    size = (size + huge_page_size - 1) / huge_page_size * huge_page_size;
+    void *region = mmap(nullptr, size, protection,
+            (flags & ~MAP_NORESERVE) | MAP_HUGETLB, -1, 0);
+    if(region != MAP_FAILED) {
+        backing = "huge pages (MAP_HUGETLB)";
+        return static_cast<char *>(region);
+    }
+
+    // Over-allocate by a huge page, and trim the ends off to align it
+    region = mmap(nullptr, size + huge_page_size, protection, flags, -1, 0);
+    if(region == MAP_FAILED)
+        return nullptr;
+
+    char *start = static_cast<char *>(region);
+    char *aligned = start + (huge_page_size -
+            uintptr_t(start) % huge_page_size) % huge_page_size;
+    if(aligned > start)
+        munmap(start, aligned - start);
+    munmap(aligned + size, start + huge_page_size - aligned);
+
+    if(madvise(aligned, size, MADV_HUGEPAGE) == 0)
+        backing = "transparent huge pages";
+    return aligned;
+}
+
+// Ask for transparent huge pages behind memory which is already allocated.
+// Only whole, aligned huge pages can be backed by one, so the advice covers
+// just those lying within the memory -- and one too small (or too unaligned)
+// to hold any is left as it is. Returns how it's backed
+const char *advise_huge_pages(const void *begin, size_t size) {
+    uintptr_t first = (uintptr_t(begin) + huge_page_size - 1) /
+            huge_page_size * huge_page_size;
+    uintptr_t last = (uintptr_t(begin) + size) / huge_page_size *
+            huge_page_size;
+
+    if(last > first && madvise(reinterpret_cast<void *>(first), last - first,
+            MADV_HUGEPAGE) == 0)
+        return "transparent huge pages";
+    return "normal";
+}
+
+// The tape: a dense run of cells, held in memory mapped straight from the
+// kernel, so untouched cells cost nothing (pages are only backed once they're
+// written). It grows in whichever direction it's reached, at least doubling
+// each time, and every access checks it's in range -- a branch which is only
+// ever taken on growth, so it's always predicted
+class Tape {
+public:
+    Tape() = default;
+    Tape(const Tape &) = delete;
+    Tape &operator=(const Tape &) = delete;
+
+    ~Tape() {
+        if(region)
+            munmap(region, region_size);
+    }
+
+    char &operator[](int position) {
+        if(__builtin_expect(position < low || position >= high, 0))
+            grow(position);
+        return region[position - low];
+    }
+
+    // The cells from first to first plus count, side by side
+    char *cells(int first, int count) {
+        (*this)[first + count - 1];
+        return &(*this)[first];
+    }
+
+    // Where the pointer ends up when it's moved to a position (which is the
+    // position itself, on a tape which grows)
+    int wrap(int position) const {
+        return position;
+    }
+
+    // Set before the tape's first used, to back it with huge pages
+    bool huge_pages = false;
+
+    // How the tape's memory ended up being backed
+    const char *backing = "normal";
+
+    // The pointer's moves are checked against the cell limit
+    static constexpr bool bounded = true;
+
+private:
+    __attribute__((noinline)) void grow(int position) {
+        long size = max<long>(2 * region_size, 1 << 16);
+        while(position < long(high) - size ||
+                position >= long(low) + size)
+            size *= 2;
+
+        size_t mapped = size;
+        char *grown = map_region(mapped, huge_pages, backing);
+        if(!grown) {
+            cerr << "Couldn't allocate the tape";
+            throw -1;
+        }
+
+        // Grow downwards when the position's below the tape, and upwards
+        // otherwise (with a new tape centred on the position)
+        long grown_low;
+        if(!region)
+            grown_low = position - long(mapped) / 2;
+        else if(position < low)
+            grown_low = high - long(mapped);
+        else
+            grown_low = low;
+
+        if(region) {
+            memcpy(grown + (low - grown_low), region, high - low);
+            munmap(region, region_size);
+        }
+
+        region = grown;
+        region_size = mapped;
+        low = grown_low;
+        high = grown_low + mapped;
+    }
+
+    char *region = nullptr;
+    size_t region_size = 0;
+    long low = 0;
+    long high = 0;
+};
+
+// A fixed-size tape which wraps round (for programs which assume a classic
+// 30,000-cell tape, or rely on wrapping). Its size is a power of two, so a
+// position is found by masking it: there's no growth, and no limit to check
+class RingTape {
+public:
+    RingTape() = default;
+    RingTape(const RingTape &) = delete;
+    RingTape &operator=(const RingTape &) = delete;
+
+    ~RingTape() {
+        if(region)
+            munmap(region, region_size);
+    }
+
+    // Set the number of cells (rounded up to a power of two), before the
+    // tape's used
+    void resize(long count, bool huge_pages) {
+        size_t size = 1;
+        while(size < size_t(count))
+            size *= 2;
+
+        region_size = size;
+        region = map_region(region_size, huge_pages, backing);
+        if(!region) {
+            cerr << "Couldn't allocate the tape";
+            throw -1;
+        }
+        mask = size - 1;
+    }
+
+    char &operator[](int position) {
+        return region[position & mask];
+    }
+
+    // The cells from first to first plus count, if they're side by side
+    // (they aren't when they wrap round the end)
+    char *cells(int first, int count) {
+        size_t start = first & mask;
+        return start + count <= mask + 1 ? region + start : nullptr;
+    }
+
+    // The pointer's kept within the ring, so a program can carry on round it
+    // forever without the pointer overflowing
+    int wrap(int position) const {
+        return position & mask;
+    }
+
+    size_t size() const {
+        return mask + 1;
+    }
+
+    const char *backing = "normal";
+
+    static constexpr bool bounded = false;
+
+private:
+    char *region = nullptr;
+    size_t region_size = 0;
+    size_t mask = 0;
+};
+
+[[noreturn]] __attribute__((cold, noinline)) void overflow_trapped() {
+    cerr << "Cell overflow";
+    throw -1;
+}
+
+// What happens when a cell's taken past either end of its range (0 to 255).
+// Each policy adds a value to a cell, and sets a cell to zero plus a value
+// (the merged runs of adds and sets are only ever merged in one direction,
+// so they saturate or trap just as the operators one by one would)
+
+// Wrap round, like the byte it is
+struct Wrap {
+    static char add(char cell, int value) {
+        return cell + value;
+    }
+
+    static char set(int value) {
+        return value;
+    }
+};
+
+// Stick at 0 or 255
+struct Saturate {
+    static char add(char cell, int value) {
+        int result = (unsigned char)cell + value;
+        return result < 0 ? 0 : result > 255 ? 255 : result;
+    }
+
+    static char set(int value) {
+        return add(0, value);
+    }
+};
+
+// Stop the program, with an error. The add (or subtract) is made on the bytes
+// themselves, so the compiler tests its carry flag rather than comparing the
+// result afterwards. No value beyond a byte can be added without overflowing
+struct Trap {
+    static char add(char cell, int value) {
+        unsigned char result;
+        bool overflowed;
+        if(value >= 0)
+            overflowed = value > 255 || __builtin_add_overflow(
+                    (unsigned char)cell, (unsigned char)value, &result);
+        else
+            overflowed = value < -255 || __builtin_sub_overflow(
+                    (unsigned char)cell, (unsigned char)-value, &result);
+
+        if(__builtin_expect(overflowed, 0))
+            overflow_trapped();
+        return result;
+    }
+
+    static char set(int value) {
+        return add(0, value);
+    }
+};
+
+enum class Overflow { Wrap, Saturate, Trap };
+
+class CodeCache;
+
+// Everything a running program can change -- the tape, the pointer, where
+// input comes from and output goes, and the statistics reported in verbose
+// mode. The engines are instantiated once for each kind of tape and each
+// overflow policy, so each runs with its own tape's accesses, and its own
+// arithmetic, inlined (wrapping costs nothing extra)
+template<class TapeType, class ArithmeticType = Wrap>
+struct BasicState {
+    typedef ArithmeticType Arithmetic;
+
+    // The stack and pointer are central to brainfuck functionality, it's the
+    // pseudo-memory which is manipulated by the code the user provides
+    TapeType stack;
+    int pointer = 0;
+    int cell_limit = 256;
+
+    // The read position in the input file (when there is one). These stay
+    // equal when reading interactively
+    const char *input_cursor = nullptr;
+    const char *input_end = nullptr;
+    bool input_from_file = false;
+
+    streambuf *output = nullptr;
+
+    // Where the loop bodies parsed as the program runs are held, when they're
+    // held to a budget
+    CodeCache *code_cache = nullptr;
+
+    // Where the bytes typed in are logged, when they're recorded
+    InputRecording *recording = nullptr;
+
+    // The terminal, when keys are read as they're pressed
+    RawTerminal *terminal = nullptr;
+
+    // Some variables used when the verbosity flag is set
+    int lowest_cell = 0;
+    int greatest_cell = 0;
+    long operations = 0;
+    long left_shifts = 0;
+    long right_shifts = 0;
+    long characters_printed = 0;
+};
+
+typedef BasicState<Tape> State;
+
+// Get the next byte of input for a cell. Once an input file runs out, cells
+// read as zero
+template<class StateType>
+inline char read_cell(StateType &state) {
+    if(state.input_cursor != state.input_end)
+        return *state.input_cursor++;
+    else if(state.input_from_file)
+        return 0;
+
+    char value = state.terminal ? state.terminal->get_key() : get_input();
+    if(state.recording)
+        state.recording->record(value, state.characters_printed);
+    return value;
+}
+
+// Write the value of a cell (or a question mark, if it's outside the
+// printable ASCII range)
+// TODO: Decide whether to ignore such output, because it technically goes
+// against specification
+template<class StateType>
+inline void print_cell(StateType &state, char value) {
+    if(value < ' ' || value > '~')
+        value = '?';
+
+    state.output->sputc(value);
+    state.characters_printed += 1;
+}
+
+// Report the cell limit being exceeded. This is kept out of line, and marked
+// cold, so the check made on every move stays small and the compiler lays
+// the failure out away from the code running the program
+[[noreturn]] __attribute__((cold, noinline)) void limit_reached() {
+    cerr << "Stack size limit reached";
+    throw -1;
+}
+
+// Increment or decrement the cell pointer (only tracking the cells used on
+// a tape which has a limit)
+template<class StateType>
+inline void move_pointer(StateType &state, int shift) {
+    constexpr bool bounded = decltype(state.stack)::bounded;
+
+    state.pointer = state.stack.wrap(state.pointer + shift);
+    if(shift > 0) {
+        state.right_shifts += shift;
+        if(bounded)
+            state.greatest_cell = max(state.pointer, state.greatest_cell);
+    }
+    else {
+        state.left_shifts -= shift;
+        if(bounded)
+            state.lowest_cell = min(state.pointer, state.lowest_cell);
+    }
+
+    // Check the number of cells being used doesn't exceed the limit (which
+    // could indicate that there's an endless loop)
+    if(bounded && __builtin_expect(abs(state.greatest_cell) +
+            abs(state.lowest_cell) > state.cell_limit, 0))
+        limit_reached();
+}
+
+// Read into consecutive cells. As much of the block as the input file still
+// holds is copied in one go, and the rest of the cells are read one at a time
+// (which zeroes them past the end of a file, or prompts for each
+// interactively)
+template<class StateType>
+inline void read_block(StateType &state, int start, int count) {
+    int cell = 0;
+
+    int available = min<long>(count, state.input_end - state.input_cursor);
+    if(available > 0) {
+        if(char *cells = state.stack.cells(start, available))
+            memcpy(cells, state.input_cursor, available);
+        else {
+            for(; cell < available; cell += 1)
+                state.stack[start + cell] = state.input_cursor[cell];
+        }
+
+        state.input_cursor += available;
+        cell = available;
+    }
+
+    for(; cell < count; cell += 1)
+        state.stack[start + cell] = read_cell(state);
+}
+
+// Print consecutive cells
+template<class StateType>
+inline void write_block(StateType &state, int start, int count) {
+    for(int cell = 0; cell < count; cell += 1)
+        print_cell(state, state.stack[start + cell]);
+}
+
+// Holds the loop bodies parsed as a program runs (the nearest thing to
+// compiled code the switch engine has) to a budget. Once the bodies held pass
+// it, the least recently used are evicted -- approximately, by the clock
+// algorithm: an entry is marked whenever its loop is entered, and the hand
+// clears the marks as it sweeps, evicting the first unmarked entry it finds.
+// An evicted loop goes back to its instructions, and is parsed again if it's
+// entered again. Loops which are running are pinned, so they're never evicted
+// from under the engine, and the slots of evicted entries are reused
+class CodeCache {
+public:
+    explicit CodeCache(size_t budget) : budget(budget) {}
+
+    // Enter a loop, parsing its body if it isn't held
+    void enter(const Operation &loop) {
+        if(!loop.body) {
+            loop.body = make_shared<const vector<Operation>>(
+                    parse_range(loop.unparsed_begin, loop.unparsed_end,
+                    loop.unparsed_matches));
+            add(loop);
+            entries[loop.cache_entry].pinned = true;
+            evict_to_budget();
+        }
+        else if(loop.cache_entry >= 0) {
+            Entry &entry = entries[loop.cache_entry];
+            entry.marked = entry.pinned = true;
+        }
+    }
+
+    void leave(const Operation &loop) {
+        if(loop.cache_entry >= 0)
+            entries[loop.cache_entry].pinned = false;
+    }
+
+    // Forget every body, before the program they belong to is thrown away
+    void clear() {
+        entries.clear();
+        free_slots.clear();
+        hand = 0;
+        resident_bytes = 0;
+    }
+
+    size_t resident_bytes = 0;
+    size_t peak_bytes = 0;
+    long evictions = 0;
+
+private:
+    struct Entry {
+        const Operation *loop = nullptr;
+        size_t bytes = 0;
+        bool marked = false;
+        bool pinned = false;
+    };
+
+    void add(const Operation &loop) {
+        int slot;
+        if(free_slots.empty()) {
+            slot = entries.size();
+            entries.emplace_back();
+        }
+        else {
+            slot = free_slots.back();
+            free_slots.pop_back();
+        }
+
+        size_t bytes = sizeof(vector<Operation>) +
+                loop.body->capacity() * sizeof(Operation);
+        entries[slot] = {&loop, bytes, true, false};
+        loop.cache_entry = slot;
+
+        resident_bytes += bytes;
+        peak_bytes = max(peak_bytes, resident_bytes);
+    }
+
+    // Sweep until the bodies held fit the budget, or two whole sweeps in a row
+    // find nothing which can be evicted (everything left is running)
+    void evict_to_budget() {
+        size_t misses = 0;
+        while(resident_bytes > budget && misses < 2 * entries.size()) {
+            hand = (hand + 1) % entries.size();
+            Entry &entry = entries[hand];
+
+            if(!entry.loop || entry.pinned)
+                misses += 1;
+            else if(entry.marked) {
+                entry.marked = false;
+                misses += 1;
+            }
+            else {
+                evict(hand);
+                misses = 0;
+            }
+        }
+    }
+
+    // The loops inside a body are evicted with it (they're held by it)
+    void evict(int slot) {
+        const Operation &loop = *entries[slot].loop;
+        for(const Operation &inner : *loop.body) {
+            if(inner.code == Code::Loop && inner.cache_entry >= 0)
+                evict(inner.cache_entry);
+        }
+
+        resident_bytes -= entries[slot].bytes;
+        evictions += 1;
+        loop.body.reset();
+        loop.cache_entry = -1;
+        entries[slot] = Entry();
+        free_slots.push_back(slot);
+    }
+
+    size_t budget;
+    vector<Entry> entries;
+    vector<int> free_slots;
+    size_t hand = 0;
+};
+
+// Run a block of operations (from the given index onwards)
+template<class StateType>
+void execute(const vector<Operation> &block, StateType &state,
+        size_t start = 0) {
+    for(size_t index = start; index < block.size(); index += 1) {
+        const Operation &operation = block[index];
+
+        // Increment the number of operations performed (reported in verbose
+        // mode), by the operators the operation stands for
+        state.operations += weight(operation);
+
+        switch(operation.code) {
+
+            // Increment or decrement the value of the current cell
+            case Code::Add: {
+                char &cell = state.stack[state.pointer];
+                cell = StateType::Arithmetic::add(cell, operation.value);
+                break;
+            }
+
+            case Code::Move:
+                move_pointer(state, operation.value);
+                break;
+
+            case Code::Print:
+                print_cell(state, state.stack[state.pointer]);
+                break;
+
+            case Code::Read:
+                state.stack[state.pointer] = read_cell(state);
+                break;
+
+            // Repeat the body until the current cell is zero (each check at
+            // the end of the body counts as an operation, like the closing
+            // bracket it came from). The cell is only tested on entry when
+            // it isn't known already
+            case Code::Loop:
+                if(operation.value < 0 ||
+                        (operation.value == 0 && !state.stack[state.pointer]))
+                    break;
+
+                if(state.code_cache)
+                    state.code_cache->enter(operation);
+                else
+                    parse_body(operation);
+
+                do {
+                    execute(*operation.body, state);
+                    state.operations += 1;
+                } while(state.stack[state.pointer]);
+
+                if(state.code_cache)
+                    state.code_cache->leave(operation);
+                break;
+
+            // Each pass of the [-] counts a decrement and a check
+            case Code::Set: {
+                char &cell = state.stack[state.pointer];
+                state.operations += 2 * (unsigned char)cell;
+                cell = StateType::Arithmetic::set(operation.value);
+                break;
+            }
+
+            case Code::ReadBlock:
+                read_block(state, state.pointer + operation.offset,
+                        operation.value);
+                break;
+
+            case Code::WriteBlock:
+                write_block(state, state.pointer + operation.offset,
+                        operation.value);
+                break;
+        }
+    }
+}
+
+// Run a program while it's still being read from a stream: each piece of
+// top-level code is run as soon as its brackets balance, then thrown away --
+// so only an unfinished top-level loop is ever held in memory. Returns the
+// number of operators read
+template<class StateType>
+long run_stream(int descriptor, StateType &state) {
+    string pending;
+    long depth = 0;
+    size_t scanned = 0;
+    long operator_count = 0;
+    char chunk[1 << 16];
+
+    while(true) {
+        ssize_t size = read(descriptor, chunk, sizeof chunk);
+        if(size < 0) {
+            if(errno == EINTR)
+                continue;
+            cerr << "Couldn't read the program";
+            throw -1;
+        }
+        if(size == 0)
+            break;
+
+        // Find the end of the last complete piece of top-level code
+        pending.append(chunk, size);
+        size_t complete = 0;
+        for(; scanned < pending.size(); scanned += 1) {
+            if(pending[scanned] == '[' && ++ depth > max_nesting)
+                nesting_exceeded();
+            else if(pending[scanned] == ']' && -- depth < 0) {
+                cerr << "Syntax error";
+                throw -1;
+            }
+
+            if(depth == 0)
+                complete = scanned + 1;
+        }
+
+        if(complete == 0)
+            continue;
+
+        // Loops are parsed from the pending instructions as they're entered,
+        // so they can only be discarded once this piece has finished running
+        vector<int> matches = match_brackets(pending.data(),
+                pending.data() + complete);
+        vector<Operation> piece = parse_range(pending.data(),
+                pending.data() + complete, matches.data());
+        execute(piece, state);
+        if(state.code_cache)
+            state.code_cache->clear();
+
+        operator_count += count_operators(pending.substr(0, complete));
+        pending.erase(0, complete);
+        scanned -= complete;
+    }
+
+    if(depth != 0) {
+        cerr << "Syntax error";
+        throw -1;
+    }
+
+    return operator_count;
+}
+
+// A position part way through a block of operations
+struct Frame {
+    const vector<Operation> *block;
+    size_t index;
+};
+
+// Pick a run up part way through the program. The frames hold the position in
+// each block, from the program down to the innermost block: the innermost is
+// resumed at its index, and each outer frame's index is the loop it was
+// running, which is finished before moving on
+void resume(const vector<Frame> &frames, State &state) {
+    for(size_t depth = frames.size(); depth-- > 0;) {
+        const Frame &frame = frames[depth];
+        size_t index = frame.index;
+
+        if(depth + 1 < frames.size()) {
+            state.operations += 1;
+            const Operation &loop = (*frame.block)[index];
+            while(state.stack[state.pointer]) {
+                execute(*loop.body, state);
+                state.operations += 1;
+            }
+
+            index += 1;
+        }
+
+        execute(*frame.block, state, index);
+    }
+}
+
+// Whether running the block is guaranteed to leave the pointer where it
+// started -- its shifts cancel out, and so do those of every loop inside it
+bool is_balanced(const vector<Operation> &block) {
+    int shift = 0;
+
+    for(const Operation &operation : block) {
+        if(operation.code == Code::Move)
+            shift += operation.value;
+        else if(operation.code == Code::Loop && !is_balanced(*operation.body))
+            return false;
+    }
+
+    return shift == 0;
+}
+
+// Whether a loop body makes the loop a conditional -- one which runs at most
+// once -- small and free enough of side effects to be run without a branch.
+// It's straight-line adds and sets whose shifts cancel out, and the last of
+// them to touch the cell being tested sets it to zero
+bool is_conditional(const vector<Operation> &body) {
+    if(body.empty() || body.size() > 8)
+        return false;
+
+    int shift = 0;
+    bool cleared = false;
+    for(const Operation &operation : body) {
+        if(operation.code == Code::Move)
+            shift += operation.value;
+        else if(operation.code == Code::Add) {
+            if(shift == 0)
+                cleared = false;
+        }
+        else if(operation.code == Code::Set) {
+            if(shift == 0)
+                cleared = operation.value == 0;
+        }
+        else
+            return false;
+    }
+
+    return shift == 0 && cleared;
+}
+
+// The threaded engine flattens the operations into a single array, with each
+// loop turned into a pair of conditional jumps. Every handler jumps straight
+// to the handler of the next instruction (using GCC's labels as values),
+// rather than returning to a switch, or recursing into loop bodies -- which
+// costs an extra pass over the program before running, but less per
+// operation performed
+class ThreadedProgram {
+public:
+    // The top level is split into pieces which each end with a loop, and
+    // each outlined loop body (see below) is a piece of its own. Each piece
+    // is lowered separately (spread across threads, for large programs) with
+    // its jumps relative to its own start, and the pieces are then stitched
+    // together -- so the result is the same however the pieces were lowered.
+    // The hot code (the top level, then the subroutines) comes first, and
+    // all the cold code after it
+    explicit ThreadedProgram(const vector<Operation> &program,
+            bool parallel = false) {
+        find_subroutines(program);
+
+        vector<size_t> ends;
+        for(size_t index = 0; index < program.size(); index += 1) {
+            if(program[index].code == Code::Loop)
+                ends.push_back(index + 1);
+        }
+        if(ends.empty() || ends.back() != program.size())
+            ends.push_back(program.size());
+
+        vector<Piece> pieces(ends.size() + subroutine_bodies.size());
+        auto lower_piece = [&](size_t piece) {
+            if(piece >= ends.size()) {
+                lower_subroutine(*subroutine_bodies[piece - ends.size()],
+                        pieces[piece]);
+                return;
+            }
+
+            size_t begin = piece == 0 ? 0 : ends[piece - 1];
+            for(size_t index = begin; index < ends[piece]; index += 1)
+                lower(program[index], pieces[piece], pieces[piece].hot,
+                        false);
+        };
+
+        if(parallel)
+            parallel_for(pieces.size(), lower_piece);
+        else {
+            for(size_t piece = 0; piece < pieces.size(); piece += 1)
+                lower_piece(piece);
+        }
+
+        // Work out where each section goes (with the halt after the top
+        // level)
+        vector<int> hot_bases, cold_bases;
+        int position = 0;
+        for(size_t piece = 0; piece < pieces.size(); piece += 1) {
+            if(piece == ends.size())
+                position += 1;
+            hot_bases.push_back(position);
+            position += pieces[piece].hot.size();
+        }
+        if(subroutine_bodies.empty())
+            position += 1;
+        for(size_t piece = 0; piece < pieces.size(); piece += 1) {
+            cold_bases.push_back(position);
+            position += pieces[piece].cold.size();
+        }
+
+        // Then copy them there, moving each jump by the base of the section
+        // it jumps into
+        auto place = [&](vector<Instruction> &section, size_t piece,
+                int base) {
+            for(Instruction &instruction : section) {
+                if(instruction.step == Step::LoopStart ||
+                        instruction.step == Step::LoopEnd)
+                    instruction.value += base;
+                else if(instruction.step == Step::Branch)
+                    instruction.value += cold_bases[piece];
+                else if(instruction.step == Step::Jump)
+                    instruction.value += hot_bases[piece];
+                else if(instruction.step == Step::Call)
+                    instruction.value = hot_bases[ends.size() +
+                            instruction.value];
+                code.push_back(instruction);
+            }
+        };
+
+        for(size_t piece = 0; piece < pieces.size(); piece += 1) {
+            if(piece == ends.size())
+                code.push_back({Step::Halt});
+            place(pieces[piece].hot, piece, hot_bases[piece]);
+        }
+        if(subroutine_bodies.empty())
+            code.push_back({Step::Halt});
+        for(size_t piece = 0; piece < pieces.size(); piece += 1)
+            place(pieces[piece].cold, piece, cold_bases[piece]);
+    }
+
+    // The number of instructions the program was flattened into
+    size_t size() const {
+        return code.size();
+    }
+
+    // Ask for the code to be backed by huge pages, returning how it's backed
+    const char *use_huge_pages() const {
+        return advise_huge_pages(code.data(),
+                code.size() * sizeof(Instruction));
+    }
+
+    template<class StateType>
+    void run(StateType &state);
+
+private:
+    enum class Step {
+        Add, Move, Print, Read, ReadBlock, WriteBlock, Set, LoopStart,
+        LoopEnd, Call, Return, If, MaskedAdd, MaskedMove, MaskedSet, Branch,
+        Jump, Halt
+    };
+
+    // The value of a loop's start is the index just past its end, and the
+    // value of its end is the index of the first instruction of its body. A
+    // call's value is the index of the subroutine it calls, and a branch or
+    // jump's the index it goes to. The weight is the number of operations the
+    // instruction counts
+    struct Instruction {
+        Step step;
+        int value = 0;
+        int offset = 0;
+        int weight = 0;
+        const void *handler = nullptr;
+    };
+
+    // A piece of the program as it's lowered: its hot code, and the cold
+    // code moved out of the way of it
+    struct Piece {
+        vector<Instruction> hot;
+        vector<Instruction> cold;
+    };
+
+    // Loops whose (shared) body turns up in several places, and is big enough
+    // for the saving to outweigh a call and return, are outlined: the loop is
+    // lowered once, as a subroutine, and called from each place it's used.
+    // Since a loop only ever works relative to the pointer, the same code
+    // serves wherever the pointer happens to be. Subroutines are numbered in
+    // the order they're first met, so the numbering is always the same
+    void find_subroutines(const vector<Operation> &program) {
+        unordered_map<const vector<Operation> *, Uses> uses;
+        vector<const vector<Operation> *> order;
+        count_uses(program, uses, order);
+
+        for(const vector<Operation> *body : order) {
+            if(uses[body].sites > 1 && uses[body].size >= 16) {
+                subroutines[body] = subroutine_bodies.size();
+                subroutine_bodies.push_back(body);
+            }
+        }
+    }
+
+    struct Uses {
+        int sites = 0;
+        size_t size = 0;
+    };
+
+    // Count the places each shared body is used, visiting each one's own
+    // loops once however many places it's used in. Only bodies with more than
+    // one owner can be used in more than one place, so the rest are just
+    // walked through. Returns the block's size, when everything in it is
+    // lowered in place
+    static size_t count_uses(const vector<Operation> &block,
+            unordered_map<const vector<Operation> *, Uses> &uses,
+            vector<const vector<Operation> *> &order) {
+        size_t size = 0;
+
+        for(const Operation &operation : block) {
+            size += 1;
+            if(operation.code != Code::Loop)
+                continue;
+
+            const vector<Operation> *body = operation.body.get();
+            if(operation.body.use_count() == 1) {
+                size += 1 + count_uses(*body, uses, order);
+                continue;
+            }
+
+            Uses &body_uses = uses[body];
+            if(body_uses.sites++ == 0) {
+                order.push_back(body);
+                body_uses.size = count_uses(*body, uses, order);
+            }
+
+            size += 1 + body_uses.size;
+        }
+
+        return size;
+    }
+
+    // A subroutine is its loop, followed by a return
+    void lower_subroutine(const vector<Operation> &body, Piece &piece) const {
+        vector<Instruction> &code = piece.hot;
+        code.push_back({Step::LoopStart, 0, 0, 1});
+        for(const Operation &inner : body)
+            lower(inner, piece, code, true);
+        code.push_back({Step::LoopEnd, 1, 0, 1});
+        code[0].value = code.size();
+        code.push_back({Step::Return});
+    }
+
+    // Whether a loop nested in another should be moved out of line: it does
+    // input or output itself, so it's slow (and usually rare) next to the
+    // arithmetic around it, and an extra jump costs it nothing
+    static bool is_cold(const Operation &loop) {
+        if(loop.value != 0)
+            return false;
+
+        for(const Operation &operation : *loop.body) {
+            if(operation.code == Code::Print || operation.code == Code::Read ||
+                    operation.code == Code::ReadBlock ||
+                    operation.code == Code::WriteBlock)
+                return true;
+        }
+
+        return false;
+    }
+
+    // Lower an operation onto the end of the code, one of the piece's two
+    // sections. Nested is set inside loops
+    void lower(const Operation &operation, Piece &piece,
+            vector<Instruction> &code, bool nested) const {
+        switch(operation.code) {
+            case Code::Add:
+                code.push_back({Step::Add, operation.value, 0,
+                        weight(operation)});
+                break;
+
+            case Code::Move:
+                code.push_back({Step::Move, operation.value, 0,
+                        weight(operation)});
+                break;
+
+            case Code::Print:
+                code.push_back({Step::Print, 0, 0, 1});
+                break;
+
+            case Code::Read:
+                code.push_back({Step::Read, 0, 0, 1});
+                break;
+
+            case Code::ReadBlock:
+                code.push_back({Step::ReadBlock, operation.value,
+                        operation.offset, weight(operation)});
+                break;
+
+            case Code::WriteBlock:
+                code.push_back({Step::WriteBlock, operation.value,
+                        operation.offset, weight(operation)});
+                break;
+
+            case Code::Set:
+                code.push_back({Step::Set, operation.value, 0,
+                        weight(operation)});
+                break;
+
+            // A dead loop is just its test, which always falls through
+            case Code::Loop: {
+                if(operation.value < 0) {
+                    code.push_back({Step::LoopStart, int(code.size()) + 1, 0,
+                            1});
+                    break;
+                }
+
+                // A conditional is predicated rather than branched over: its
+                // test sets a mask, and every step of its body is masked (so
+                // does nothing when the cell's zero). The test counts the
+                // whole body, and the check at its end, when the mask's set
+                if(is_conditional(*operation.body)) {
+                    int total = 1;
+                    for(const Operation &inner : *operation.body)
+                        total += weight(inner);
+
+                    code.push_back({Step::If, 0, 0, total});
+                    for(const Operation &inner : *operation.body) {
+                        Step step = inner.code == Code::Add ?
+                                Step::MaskedAdd : inner.code == Code::Move ?
+                                Step::MaskedMove : Step::MaskedSet;
+                        code.push_back({step, inner.value});
+                    }
+                    break;
+                }
+
+                auto subroutine = subroutines.find(operation.body.get());
+                if(subroutine != subroutines.end()) {
+                    code.push_back({Step::Call, subroutine->second});
+                    break;
+                }
+
+                // A cold loop in hot code becomes a branch out to the cold
+                // section, where the loop runs and then jumps back
+                if(nested && &code == &piece.hot && is_cold(operation)) {
+                    int start = piece.cold.size();
+                    code.push_back({Step::Branch, start, 0, 1});
+                    for(const Operation &inner : *operation.body)
+                        lower(inner, piece, piece.cold, true);
+                    piece.cold.push_back({Step::LoopEnd, start, 0, 1});
+                    piece.cold.push_back({Step::Jump, int(code.size())});
+                    break;
+                }
+
+                // A loop which is always entered (right after a set) has no
+                // test on entry: the set counts it instead
+                int start = code.size();
+                if(operation.value > 0)
+                    code.back().weight += 1;
+                else
+                    code.push_back({Step::LoopStart, 0, 0, 1});
+                for(const Operation &inner : *operation.body)
+                    lower(inner, piece, code, true);
+                code.push_back({Step::LoopEnd,
+                        operation.value > 0 ? start : start + 1, 0, 1});
+                if(operation.value == 0)
+                    code[start].value = code.size();
+                break;
+            }
+        }
+    }
+
+    unordered_map<const vector<Operation> *, int> subroutines;
+    vector<const vector<Operation> *> subroutine_bodies;
+    vector<Instruction> code;
+};
+
+template<class StateType>
+void ThreadedProgram::run(StateType &state) {
+
+    // In the same order as the steps
+    static const void *handlers[] = {
+        &&add, &&move, &&print, &&read, &&read_block, &&write_block, &&set,
+        &&loop_start, &&loop_end, &&call, &&return_, &&if_, &&masked_add,
+        &&masked_move, &&masked_set, &&branch, &&jump, &&halt
+    };
+
+    if(code.front().handler == nullptr) {
+        for(Instruction &instruction : code)
+            instruction.handler = handlers[int(instruction.step)];
+    }
+
+    // Operations are counted locally, and added to the state when the
+    // program finishes -- or when an error unwinds out of it, so a REPL entry
+    // which fails still counts what it performed
+    long operations = 0;
+    struct Tally {
+        long &operations;
+        long &total;
+        ~Tally() { total += operations; }
+    } tally{operations, state.operations};
+    vector<const Instruction *> returns;
+    int mask = 0;
+    constexpr bool bounded = decltype(state.stack)::bounded;
+    typedef typename StateType::Arithmetic Arithmetic;
+    const Instruction *instruction = code.data();
+    goto *instruction->handler;
+
+add: {
+    char &cell = state.stack[state.pointer];
+    operations += instruction->weight;
+    cell = Arithmetic::add(cell, instruction->value);
+    goto *(++ instruction)->handler;
+}
+
+move:
+    operations += instruction->weight;
+    move_pointer(state, instruction->value);
+    goto *(++ instruction)->handler;
+
+print:
+    operations += 1;
+    print_cell(state, state.stack[state.pointer]);
+    goto *(++ instruction)->handler;
+
+read:
+    operations += 1;
+    state.stack[state.pointer] = read_cell(state);
+    goto *(++ instruction)->handler;
+
+read_block:
+    operations += instruction->weight;
+    read_block(state, state.pointer + instruction->offset, instruction->value);
+    goto *(++ instruction)->handler;
+
+write_block:
+    operations += instruction->weight;
+    write_block(state, state.pointer + instruction->offset,
+            instruction->value);
+    goto *(++ instruction)->handler;
+
+set: {
+    char &cell = state.stack[state.pointer];
+    operations += instruction->weight + 2 * (unsigned char)cell;
+    cell = Arithmetic::set(instruction->value);
+    goto *(++ instruction)->handler;
+}
+
+loop_start:
+    operations += 1;
+    if(state.stack[state.pointer] == 0)
+        instruction = &code[instruction->value];
+    else
+        instruction += 1;
+    goto *instruction->handler;
+
+loop_end:
+    operations += 1;
+    if(state.stack[state.pointer] != 0)
+        instruction = &code[instruction->value];
+    else
+        instruction += 1;
+    goto *instruction->handler;
+
+call:
+    returns.push_back(instruction + 1);
+    instruction = &code[instruction->value];
+    goto *instruction->handler;
+
+return_:
+    instruction = returns.back();
+    returns.pop_back();
+    goto *instruction->handler;
+
+// The mask is all ones when the conditional runs, and zero when it doesn't.
+// A masked move still tests the direction it moves in, but that's fixed for
+// each instruction, so it's always predicted
+if_:
+    mask = -(state.stack[state.pointer] != 0);
+    operations += 1 + (instruction->weight & mask);
+    goto *(++ instruction)->handler;
+
+masked_add: {
+    char &cell = state.stack[state.pointer];
+    cell = Arithmetic::add(cell, instruction->value & mask);
+    goto *(++ instruction)->handler;
+}
+
+masked_move:
+    if(instruction->value > 0) {
+        state.pointer = state.stack.wrap(state.pointer +
+                (instruction->value & mask));
+        state.right_shifts += instruction->value & mask;
+        if(bounded)
+            state.greatest_cell = max(state.pointer, state.greatest_cell);
+    }
+    else {
+        state.pointer = state.stack.wrap(state.pointer +
+                (instruction->value & mask));
+        state.left_shifts -= instruction->value & mask;
+        if(bounded)
+            state.lowest_cell = min(state.pointer, state.lowest_cell);
+    }
+    if(bounded && __builtin_expect(abs(state.greatest_cell) +
+            abs(state.lowest_cell) > state.cell_limit, 0))
+        limit_reached();
+    goto *(++ instruction)->handler;
+
+masked_set: {
+    char &cell = state.stack[state.pointer];
+    operations += 2 * (unsigned char)cell & mask;
+    cell = (cell & ~mask) | (Arithmetic::set(instruction->value & mask) &
+            mask);
+    goto *(++ instruction)->handler;
+}
+
+// Into the cold section, when the loop there is entered
+branch:
+    operations += 1;
+    if(__builtin_expect(state.stack[state.pointer] != 0, 0))
+        instruction = &code[instruction->value];
+    else
+        instruction += 1;
+    goto *instruction->handler;
+
+jump:
+    instruction = &code[instruction->value];
+    goto *instruction->handler;
+
+halt:
+    return;
+}
+
+// The engines which can run a single program (the wide engine is only used
+// for runs over several inputs)
+enum class Engine { Switch, Threaded, Automatic };
+
+const char *engine_name(Engine engine) {
+    if(engine == Engine::Switch)
+        return "switch";
+    else if(engine == Engine::Threaded)
+        return "threaded";
+    else
+        return "auto";
+}
+
+// Run programs a line at a time as they're typed, all on the one tape. Each
+// entry is parsed and run on its own once its brackets balance (lines which
+// leave a loop open are held until they do), then thrown away -- so nothing
+// entered before is ever parsed again. Entries run on the engine given. Left
+// to choose, an entry with loops is lowered for the threaded engine, and
+// anything else is run straight away. Lines starting with a colon look at the
+// state instead:
+//  :pointer        where the pointer is, and the cells used so far
+//  :cells [count]  the cells either side of the pointer (8 by default)
+//  :time           how long the last entry took, and what it performed
+//  :quit           leave (as does the end of input)
+// Returns the number of operators entered
+template<class StateType>
+long run_repl(StateType &state, Engine engine) {
+    string pending;
+    long depth = 0;
+    long operator_count = 0;
+    long last_operations = 0;
+    chrono::duration<double> last_time(0);
+    string line;
+
+    while(true) {
+        cout << endl << (pending.empty() ? "bf> " : "... ") << flush;
+        if(!getline(cin, line))
+            break;
+
+        if(pending.empty() && !line.empty() && line[0] == ':') {
+            istringstream command(line.substr(1));
+            string name;
+            command >> name;
+
+            if(name == "quit")
+                break;
+            else if(name == "pointer") {
+                cout << "Pointer: " << state.pointer;
+                if constexpr(decltype(state.stack)::bounded)
+                    cout << " (cells used " << state.lowest_cell << " : " <<
+                            state.greatest_cell << ")";
+                else
+                    cout << " (of a ring of " << state.stack.size() <<
+                            " cells)";
+            }
+            else if(name == "cells") {
+                int count = 8;
+                command >> count;
+                for(int cell = state.pointer - count;
+                        cell <= state.pointer + count; cell += 1) {
+                    int value = (unsigned char)state.stack[cell];
+                    if(cell == state.pointer)
+                        cout << "[" << value << "] ";
+                    else
+                        cout << value << " ";
+                }
+            }
+            else if(name == "time")
+                cout << last_time.count() << "s, " << last_operations <<
+                        " operations";
+            else
+                cout << "Unknown command: " << name;
+            continue;
+        }
+
+        // Hold on to the line until its loops are closed
+        size_t scanned = pending.size();
+        pending += line;
+        bool unmatched = false;
+        bool too_deep = false;
+        for(; scanned < pending.size(); scanned += 1) {
+            if(pending[scanned] == '[' && ++ depth > max_nesting)
+                too_deep = true;
+            else if(pending[scanned] == ']' && -- depth < 0)
+                unmatched = true;
+        }
+
+        if(unmatched || too_deep) {
+            if(unmatched)
+                cerr << "Syntax error" << endl;
+            else
+                cerr << "Loops nested more than " << max_nesting <<
+                        " deep" << endl;
+            pending.clear();
+            depth = 0;
+            continue;
+        }
+        if(depth > 0)
+            continue;
+
+        // An error part way through (a limit reached, or an overflow
+        // trapped) ends the entry, but leaves the tape as it was then
+        auto start = chrono::steady_clock::now();
+        long operations = state.operations;
+        try {
+            vector<int> matches = match_brackets(pending.data(),
+                    pending.data() + pending.size());
+            vector<Operation> entry = parse_range(pending.data(),
+                    pending.data() + pending.size(), matches.data());
+            bool lower = engine == Engine::Threaded ||
+                    (engine == Engine::Automatic &&
+                    count(pending.begin(), pending.end(), '[') > 0);
+            if(lower) {
+                parse_all(entry);
+                ThreadedProgram threaded(entry);
+                threaded.run(state);
+            }
+            else
+                execute(entry, state);
+        }
+        catch(...) {
+            cerr << endl;
+        }
+        if(state.code_cache)
+            state.code_cache->clear();
+        cout.flush();
+
+        last_time = chrono::steady_clock::now() - start;
+        last_operations = state.operations - operations;
+        operator_count += count_operators(pending);
+        pending.clear();
+    }
+
+    return operator_count;
+}
+
+// Hash the operators between two pointers (ignoring comments)
+uint64_t hash_operators(const char *begin, const char *end) {
+    string operators = "+-<>.,[]";
+
+    // 64-bit FNV-1a
+    uint64_t hash = 14695981039346656037ull;
+    for(const char *instruction = begin; instruction < end; instruction += 1) {
+        if(operators.find(*instruction) != string::npos) {
+            hash ^= (unsigned char)*instruction;
+            hash *= 1099511628211ull;
+        }
+    }
+
+    return hash;
+}
+
+// Hash a run of bytes (an input file, say)
+uint64_t hash_bytes(const char *begin, const char *end) {
+
+    // 64-bit FNV-1a
+    uint64_t hash = 14695981039346656037ull;
+    for(const char *byte = begin; byte < end; byte += 1) {
+        hash ^= (unsigned char)*byte;
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+// Hash the operators of a program, to recognise it on later runs
+uint64_t hash_program(const string &instructions) {
+    return hash_operators(instructions.data(),
+            instructions.data() + instructions.size());
+}
+
+// Whether a loop is straight-line code: it has no loops or input and output
+// inside it, and its shifts cancel out. If so, the step is the constant it
+// adds to the cell it tests on each iteration
+bool is_straight_loop(const Operation &loop, int &step) {
+    int shift = 0;
+    step = 0;
+
+    for(const Operation &operation : *loop.body) {
+        if(operation.code == Code::Move)
+            shift += operation.value;
+        else if(operation.code == Code::Add) {
+            if(shift == 0)
+                step += operation.value;
+        }
+        else
+            return false;
+    }
+
+    return shift == 0;
+}
+
+// Whether a loop counts its cell down (or up) to zero: it's straight-line
+// code which changes the cell it tests. These run a predictable number of
+// times
+bool is_counted_loop(const Operation &loop) {
+    int step;
+    return is_straight_loop(loop, step) && step % 256 != 0;
+}
+
+// A rough guess at how many operations running a block will perform, from its
+// shape alone: counted loops are assumed to run 128 times (the average, when
+// the count is a random cell), and any other loop 16 times
+double guess_operations(const vector<Operation> &block) {
+    double operations = 0;
+
+    for(const Operation &operation : block) {
+        if(operation.code == Code::Loop) {
+            double trips = is_counted_loop(operation) ? 128 : 16;
+            operations += 1 + trips * (guess_operations(*operation.body) + 1);
+        }
+        else if(operation.code == Code::Set)
+            operations += weight(operation) + 256;
+        else
+            operations += weight(operation);
+    }
+
+    return operations;
+}
+
+// What's been learned from earlier automatic engine choices: how fast each
+// engine turned out to be, and how many operations each program performed.
+// It's kept in a small text file in the user's home directory
+class EngineHistory {
+public:
+    EngineHistory() {
+        const char *home = getenv("HOME");
+        if(!home)
+            return;
+
+        file_name = string(home) + "/.hainault_history";
+        ifstream file(file_name);
+        string kind;
+        while(file >> kind) {
+            if(kind == "engine") {
+                int engine;
+                Rates rates;
+                file >> engine >> rates.operation >> rates.lowering;
+                if(file && engine >= 0 && engine < 2)
+                    engines[engine] = rates;
+            }
+            else if(kind == "program") {
+                uint64_t hash;
+                double operations;
+                file >> hex >> hash >> dec >> operations;
+                if(file)
+                    remember(hash, operations);
+            }
+            else
+                break;
+        }
+    }
+
+    // Estimated nanoseconds to perform an operation, and to lower one
+    // before running
+    double operation_cost(Engine engine) const {
+        return engines[int(engine)].operation;
+    }
+
+    double lowering_cost(Engine engine) const {
+        return engines[int(engine)].lowering;
+    }
+
+    // How many operations the program performed when it last ran, if it's
+    // been run before
+    bool recall(uint64_t hash, double &operations) const {
+        for(auto &entry : programs) {
+            if(entry.first == hash) {
+                operations = entry.second;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    // Fold the outcome of a run into the history, and save it. Timings of
+    // very short runs are mostly noise, so they only update the program's
+    // operation count
+    void record(Engine engine, uint64_t hash, long operations,
+            double run_seconds, size_t lowered, double lowering_seconds) {
+        remember(hash, operations);
+
+        Rates &rates = engines[int(engine)];
+        if(operations > 100000)
+            rates.operation += (run_seconds * 1e9 / operations -
+                    rates.operation) / 4;
+        if(lowered > 10000)
+            rates.lowering += (lowering_seconds * 1e9 / lowered -
+                    rates.lowering) / 4;
+
+        if(file_name.empty())
+            return;
+
+        ofstream file(file_name);
+        for(int index = 0; index < 2; index += 1) {
+            file << "engine " << index << " " << engines[index].operation <<
+                    " " << engines[index].lowering << endl;
+        }
+        for(auto &entry : programs) {
+            file << "program " << hex << entry.first << dec << " " <<
+                    entry.second << endl;
+        }
+    }
+
+private:
+    struct Rates {
+        double operation;
+        double lowering;
+    };
+
+    // Keep the most recently run programs, up to a limit
+    void remember(uint64_t hash, double operations) {
+        for(size_t index = 0; index < programs.size(); index += 1) {
+            if(programs[index].first == hash) {
+                programs.erase(programs.begin() + index);
+                break;
+            }
+        }
+
+        programs.emplace_back(hash, operations);
+        if(programs.size() > 1000)
+            programs.erase(programs.begin());
+    }
+
+    string file_name;
+
+    // Measured on a typical x86-64 machine, until there's history to go on
+    Rates engines[2] = {{10.0, 0.0}, {6.0, 20.0}};
+
+    vector<pair<uint64_t, double>> programs;
+};
+
+// Runs which have finished, kept on disk so that a run made before -- the
+// same program, on the same input, with the same options, which between them
+// decide everything it does -- can be answered without running anything.
+// Each run is a file, named by a hash of all three, holding its statistics
+// and what it printed. The store's held to a size by removing the least
+// recently used runs
+class MemoStore {
+public:
+    struct Run {
+
+        // Runs made in lockstep only keep their output
+        bool has_statistics = false;
+        long operations = 0;
+        int lowest_cell = 0;
+        int greatest_cell = 0;
+        long left_shifts = 0;
+        long right_shifts = 0;
+        string output;
+    };
+
+    explicit MemoStore(size_t capacity) : capacity(capacity) {
+        const char *home = getenv("HOME");
+        if(!home)
+            return;
+
+        directory = string(home) + "/.hainault_memo";
+        mkdir(directory.c_str(), 0755);
+    }
+
+    // The key a run's kept under
+    static uint64_t key(uint64_t program_hash, uint64_t input_hash,
+            int cell_limit, long ring_cells, Overflow overflow) {
+        uint64_t fields[] = {program_hash, input_hash, uint64_t(cell_limit),
+                uint64_t(ring_cells), uint64_t(overflow)};
+
+        // 64-bit FNV-1a
+        uint64_t hash = 14695981039346656037ull;
+        for(uint64_t field : fields) {
+            hash ^= field;
+            hash *= 1099511628211ull;
+        }
+
+        return hash;
+    }
+
+    // Find a run, if it's been kept with what's needed of it (and mark it as
+    // used)
+    bool recall(uint64_t key, Run &run, bool need_statistics) {
+        lookups += 1;
+        if(directory.empty())
+            return false;
+
+        string name = path(key);
+        ifstream file(name, ios::binary);
+        if(!file)
+            return false;
+
+        // A run which doesn't read back whole (cut short, or overwritten
+        // with something else) is thrown away, and counted as not kept
+        size_t size = 0;
+        file >> run.has_statistics >> run.operations >> run.lowest_cell >>
+                run.greatest_cell >> run.left_shifts >> run.right_shifts >>
+                size;
+        file.get();
+        streampos start = file.tellg();
+        file.seekg(0, ios::end);
+        streampos end = file.tellg();
+        if(!file || start < 0 || size_t(end - start) != size) {
+            discard(name);
+            return false;
+        }
+
+        file.seekg(start);
+        run.output.resize(size);
+        file.read(&run.output[0], size);
+        if(!file) {
+            discard(name);
+            return false;
+        }
+        if(need_statistics && !run.has_statistics)
+            return false;
+
+        utimensat(AT_FDCWD, name.c_str(), nullptr, 0);
+        if(indexed)
+            use(name, size_t(end));
+        hits += 1;
+        return true;
+    }
+
+    // Keep a run (unless it's too big for the store on its own). It's
+    // written alongside, then moved into place, so a run's never seen half
+    // written
+    void store(uint64_t key, const Run &run) {
+        if(directory.empty() || run.output.size() >= capacity)
+            return;
+
+        string name = path(key);
+        string written = name + ".new";
+        ofstream file(written, ios::binary);
+        file << run.has_statistics << " " << run.operations << " " <<
+                run.lowest_cell << " " << run.greatest_cell << " " <<
+                run.left_shifts << " " << run.right_shifts << " " <<
+                run.output.size() << "\n";
+        file.write(run.output.data(), run.output.size());
+        size_t size = file.tellp();
+        file.close();
+
+        if(!file || rename(written.c_str(), name.c_str()) == -1) {
+            unlink(written.c_str());
+            return;
+        }
+
+        load_index();
+        use(name, size);
+        trim();
+    }
+
+    // The runs asked for, and how many of them had been kept
+    long lookups = 0;
+    long hits = 0;
+
+private:
+    string path(uint64_t key) const {
+        char name[17];
+        snprintf(name, sizeof name, "%016llx", (unsigned long long)key);
+        return directory + "/" + name;
+    }
+
+    // The index of the runs in the store is read from the directory the
+    // first time a run's stored, ordered by when each was last used (its
+    // modification time, to the nanosecond, which recall updates). It's kept
+    // up to date from then on, so the directory is only listed once
+    void load_index() {
+        if(indexed)
+            return;
+        indexed = true;
+
+        DIR *listing = opendir(directory.c_str());
+        if(!listing)
+            return;
+
+        vector<tuple<time_t, long, size_t, string>> runs;
+        while(dirent *entry = readdir(listing)) {
+            string name = directory + "/" + entry->d_name;
+            struct stat status;
+            if(stat(name.c_str(), &status) == 0 && S_ISREG(status.st_mode))
+                runs.emplace_back(status.st_mtim.tv_sec,
+                        status.st_mtim.tv_nsec, status.st_size, name);
+        }
+        closedir(listing);
+
+        sort(runs.begin(), runs.end());
+        for(auto &run : runs)
+            use(get<3>(run), get<2>(run));
+    }
+
+    // Note a run as the most recently used
+    void use(const string &name, size_t size) {
+        forget(name);
+        uses[next_use] = name;
+        index[name] = {next_use, size};
+        next_use += 1;
+        total += size;
+    }
+
+    void forget(const string &name) {
+        auto known = index.find(name);
+        if(known == index.end())
+            return;
+
+        uses.erase(known->second.first);
+        total -= known->second.second;
+        index.erase(known);
+    }
+
+    void discard(const string &name) {
+        unlink(name.c_str());
+        forget(name);
+    }
+
+    // Remove the least recently used runs, until the rest fit
+    void trim() {
+        while(total > capacity && !uses.empty()) {
+            string oldest = uses.begin()->second;
+            discard(oldest);
+        }
+    }
+
+    size_t capacity;
+    string directory;
+
+    // Each run's name by when it was used, and its use and size by name
+    bool indexed = false;
+    long next_use = 0;
+    size_t total = 0;
+    map<long, string> uses;
+    unordered_map<string, pair<long, size_t>> index;
+};
+
+// Bounds on what running a program will do, worked out without running it
+struct Estimate {
+
+    // The most operations is infinite when there's no bound
+    double fewest_operations = 0;
+    double most_operations = 0;
+
+    // A single best guess, from the program's last run when there's been one
+    double expected_operations = 0;
+    bool expected_from_history = false;
+
+    // The furthest cells reached either side of the starting cell, unless
+    // there's no bound on that side
+    int lowest_cell = 0;
+    int greatest_cell = 0;
+    bool unbounded_left = false;
+    bool unbounded_right = false;
+
+    // Whether the program is certain to run forever
+    bool never_finishes = false;
+};
+
+// Works out an estimate by abstract interpretation: the program is followed
+// with the pointer and cell values tracked as long as they're known. Counted
+// loops (see above) are solved in closed form, other loops are followed an
+// iteration at a time while the cell they test is known, and anything which
+// can't be followed (loops over input, or whose count can't be worked out
+// within the step budget) widens the bounds instead
+class Estimator {
+public:
+    explicit Estimator(long step_budget) : step_budget(step_budget) {}
+
+    Estimate estimate(const vector<Operation> &program) {
+        run(program);
+        return result;
+    }
+
+private:
+
+    // Cells are tracked as values from 0 to 255, or -1 when unknown. Cells
+    // missing from the map are zero, until something's been written to an
+    // unknown position
+    int value(int position) const {
+        auto cell = cells.find(position);
+        if(cell != cells.end())
+            return cell->second;
+        return untouched_zero ? 0 : -1;
+    }
+
+    // Forget everything known about the cells (from first to last, or all
+    // of them)
+    void forget() {
+        cells.clear();
+        untouched_zero = false;
+    }
+
+    void forget(int first, int last) {
+        for(int position = first; position <= last; position += 1)
+            cells[position] = -1;
+    }
+
+    void count(double operations) {
+        result.fewest_operations += operations;
+        result.most_operations += operations;
+        steps += 1;
+    }
+
+    void reach(int first, int last) {
+        result.lowest_cell = min(result.lowest_cell, first);
+        result.greatest_cell = max(result.greatest_cell, last);
+    }
+
+    // The operations performed by one pass over a block without loops
+    static double straight_operations(const vector<Operation> &block) {
+        double operations = 0;
+        for(const Operation &operation : block)
+            operations += weight(operation);
+
+        return operations;
+    }
+
+    // The cells a block reaches relative to where it starts, and where it
+    // leaves the pointer. Fails if a loop inside it doesn't leave the pointer
+    // where it found it
+    static bool block_reach(const vector<Operation> &block, int &low,
+            int &high, int &shift) {
+        low = high = shift = 0;
+
+        for(const Operation &operation : block) {
+            if(operation.code == Code::Move)
+                shift += operation.value;
+            else if(operation.code == Code::ReadBlock ||
+                    operation.code == Code::WriteBlock)
+                high = max(high, shift + operation.offset +
+                        operation.value - 1);
+            else if(operation.code == Code::Loop) {
+                int body_low, body_high, body_shift;
+                if(!block_reach(*operation.body, body_low, body_high,
+                        body_shift) || body_shift != 0)
+                    return false;
+
+                low = min(low, shift + body_low);
+                high = max(high, shift + body_high);
+            }
+
+            low = min(low, shift);
+            high = max(high, shift);
+        }
+
+        return true;
+    }
+
+    void run(const vector<Operation> &block) {
+        for(const Operation &operation : block) {
+            if(result.never_finishes)
+                return;
+
+            switch(operation.code) {
+                case Code::Add:
+                    count(weight(operation));
+                    if(pointer_known) {
+                        int cell = value(pointer);
+                        cells[pointer] = cell < 0 ? -1 :
+                                (cell + operation.value) & 255;
+                    }
+                    else
+                        forget();
+                    break;
+
+                case Code::Move:
+                    count(weight(operation));
+                    if(pointer_known || pointer_bound != 0) {
+                        pointer += operation.value;
+                        reach(pointer, pointer);
+                    }
+                    break;
+
+                case Code::Print:
+                    count(1);
+                    break;
+
+                case Code::Read:
+                    count(1);
+                    if(pointer_known)
+                        cells[pointer] = -1;
+                    else
+                        forget();
+                    break;
+
+                case Code::ReadBlock:
+                case Code::WriteBlock: {
+                    count(weight(operation));
+                    int first = pointer + operation.offset;
+                    int last = first + operation.value - 1;
+                    if(!pointer_known) {
+                        if(pointer_bound != 0)
+                            reach(first, last);
+                        if(operation.code == Code::ReadBlock)
+                            forget();
+                        break;
+                    }
+
+                    reach(first, last);
+                    if(operation.code == Code::ReadBlock)
+                        forget(first, last);
+                    break;
+                }
+
+                // Clearing an unknown cell takes anywhere from none to 255
+                // passes of the [-]
+                case Code::Set: {
+                    int cell = pointer_known ? value(pointer) : -1;
+                    count(weight(operation) + 2 * max(cell, 0));
+                    if(cell < 0)
+                        result.most_operations += 2 * 255;
+
+                    if(pointer_known)
+                        cells[pointer] = operation.value & 255;
+                    else
+                        forget();
+                    break;
+                }
+
+                case Code::Loop:
+                    run_loop(operation);
+                    break;
+            }
+        }
+    }
+
+    void run_loop(const Operation &loop) {
+        int cell = pointer_known ? value(pointer) : -1;
+        count(1);
+        if(cell == 0 || loop.value < 0)
+            return;
+
+        // A straight-line loop with a known count runs until the count,
+        // stepping by a constant, wraps round to zero (or forever, if it
+        // never does)
+        int step;
+        if(cell > 0 && is_straight_loop(loop, step)) {
+            int trips = 1;
+            while(trips <= 256 && (cell + trips * step) % 256 != 0)
+                trips += 1;
+
+            if(trips > 256) {
+                int low, high, shift;
+                block_reach(*loop.body, low, high, shift);
+                reach(pointer + low, pointer + high);
+                result.never_finishes = true;
+                result.most_operations = INFINITY;
+                return;
+            }
+
+            int shift = 0;
+            for(const Operation &operation : *loop.body) {
+                if(operation.code == Code::Move) {
+                    shift += operation.value;
+                    reach(pointer + shift, pointer + shift);
+                }
+                else if(shift != 0) {
+                    int other = value(pointer + shift);
+                    cells[pointer + shift] = other < 0 ? -1 :
+                            (other + trips * operation.value) & 255;
+                }
+            }
+
+            cells[pointer] = 0;
+            count(trips * (straight_operations(*loop.body) + 1));
+            return;
+        }
+
+        // Otherwise follow it one iteration at a time, while the cell it
+        // tests stays known
+        while(cell > 0 && steps < step_budget) {
+            run(*loop.body);
+            count(1);
+            if(result.never_finishes)
+                return;
+
+            cell = pointer_known ? value(pointer) : -1;
+            if(cell == 0)
+                return;
+        }
+
+        widen(loop);
+    }
+
+    // Account for a loop (or the rest of one) which might run any number of
+    // times
+    void widen(const Operation &loop) {
+        int low, high, shift;
+        bool bounded = block_reach(*loop.body, low, high, shift);
+
+        // Counted loops can't run more than 256 times
+        if(is_counted_loop(loop))
+            result.most_operations += 256 *
+                    (straight_operations(*loop.body) + 1);
+        else
+            result.most_operations = INFINITY;
+
+        if(bounded && shift == 0) {
+            if(pointer_known) {
+                reach(pointer + low, pointer + high);
+                forget(pointer + low, pointer + high);
+                cells[pointer] = 0;
+            }
+            else {
+                if(pointer_bound != 0)
+                    reach(pointer + low, pointer + high);
+                forget();
+            }
+            return;
+        }
+
+        // The pointer could end up anywhere in the direction the loop moves,
+        // but no further back than where it is now (if that's known, or
+        // bounded on the same side)
+        int direction = shift > 0 ? 1 : -1;
+        if(bounded && (pointer_known || pointer_bound == direction)) {
+            reach(pointer + low, pointer + high);
+            if(shift > 0)
+                result.unbounded_right = true;
+            else
+                result.unbounded_left = true;
+            pointer_bound = direction;
+        }
+        else {
+            result.unbounded_left = result.unbounded_right = true;
+            pointer_bound = 0;
+        }
+
+        pointer_known = false;
+        forget();
+    }
+
+    long step_budget;
+    long steps = 0;
+
+    // Once the pointer's unknown, it can still be bounded on one side: 1 when
+    // it's known to be at `pointer` or to the right of there, -1 when it's at
+    // `pointer` or to the left, and 0 when it could be anywhere. Moves still
+    // shift the bound
+    bool pointer_known = true;
+    int pointer = 0;
+    int pointer_bound = 0;
+    map<int, int> cells;
+    bool untouched_zero = true;
+
+    Estimate result;
+};
+
+// Estimate what running a program will do, without running it. With a
+// history (and the program's hash), the expected number of operations is
+// taken from the program's last run where there's been one
+Estimate estimate_program(const vector<Operation> &program,
+        long step_budget = 1000000, const EngineHistory *history = nullptr,
+        uint64_t hash = 0) {
+    Estimate estimate = Estimator(step_budget).estimate(program);
+
+    if(history && history->recall(hash, estimate.expected_operations))
+        estimate.expected_from_history = true;
+    else if(isfinite(estimate.most_operations))
+        estimate.expected_operations = (estimate.fewest_operations +
+                estimate.most_operations) / 2;
+    else
+        estimate.expected_operations = max(estimate.fewest_operations,
+                guess_operations(program));
+
+    return estimate;
+}
+
+// Pick the engine expected to run the program soonest, counting the time
+// spent lowering it as well as running it. The number of operations is
+// taken from history when the program's been run before, and estimated
+// otherwise (with a small budget, since the estimate adds to the run time)
+Engine choose_engine(const vector<Operation> &program, size_t operation_count,
+        uint64_t hash, const EngineHistory &history,
+        double &expected_operations) {
+    expected_operations = estimate_program(program, 10000, &history,
+            hash).expected_operations;
+
+    Engine best = Engine::Switch;
+    double best_cost = 0;
+    for(Engine engine : {Engine::Switch, Engine::Threaded}) {
+        double cost = operation_count * history.lowering_cost(engine) +
+                expected_operations * history.operation_cost(engine);
+        if(engine == Engine::Switch || cost < best_cost) {
+            best = engine;
+            best_cost = cost;
+        }
+    }
+
+    return best;
+}
+
+// Lower the operations back to brainfuck, as little of it as will do the
+// same, for other (naive) interpreters. Cells are taken to be bytes which
+// wrap round, like here. Besides dropping comments, and whatever the parse
+// already merged or dropped:
+//  - straight-line code is gathered into what it does to each cell, so runs
+//    which cancel out disappear, and the cells changed are visited in one
+//    sweep (whichever way round is shorter) rather than in program order
+//  - what's known about the cells (all zero at the start, and the one
+//    tested zero after a loop) is kept, so loops which can't be entered are
+//    dropped, and a set becomes an add from the known value, rather than a
+//    [-] and then an add
+//  - each add goes whichever way round is shorter, and a large one is made
+//    with a multiplying loop, when a neighbouring cell (among those the
+//    same straight-line code changes) is known to be zero
+//  - straight-line code at the very end is dropped, as it can't be seen
+class Minifier {
+public:
+    explicit Minifier(const vector<Operation> &program) {
+        emit(program);
+
+        // Trips out to scratch cells and back can leave moves which undo
+        // each other side by side
+        string written;
+        for(char operator_ : code) {
+            if(!written.empty() && undoes(written.back(), operator_))
+                written.pop_back();
+            else
+                written += operator_;
+        }
+        code = move(written);
+    }
+
+    string code;
+
+private:
+    // What straight-line code does to a cell: sets it to the value, or adds
+    // the value to it
+    struct Effect {
+        bool set = false;
+        int value = 0;
+    };
+
+    void emit(const vector<Operation> &block) {
+        for(const Operation &operation : block) {
+            switch(operation.code) {
+                case Code::Add:
+                    effects[position].value += operation.value;
+                    break;
+
+                case Code::Move:
+                    position += operation.value;
+                    break;
+
+                case Code::Set:
+                    effects[position] = {true, operation.value};
+                    break;
+
+                case Code::Print:
+                    flush();
+                    code += '.';
+                    break;
+
+                case Code::Read:
+                    flush();
+                    code += ',';
+                    known[0] = unknown;
+                    break;
+
+                // The run's written out cell by cell again, and the pointer
+                // left at its end
+                case Code::ReadBlock:
+                case Code::WriteBlock: {
+                    char operator_ = operation.code == Code::ReadBlock ?
+                            ',' : '.';
+                    position += operation.offset;
+                    flush();
+                    for(int cell = 0; cell < operation.value; cell += 1) {
+                        code += string(cell > 0, '>') + operator_;
+                        if(operator_ == ',')
+                            known[cell] = unknown;
+                    }
+                    move_origin(operation.value - 1);
+                    position = -operation.offset - (operation.value - 1);
+                    break;
+                }
+
+                // Nothing's known inside a loop, and after it only that the
+                // cell it tests is zero
+                case Code::Loop: {
+                    flush();
+                    int value;
+                    if(operation.value < 0 || (value_of(0, value) &&
+                            value == 0))
+                        break;
+
+                    code += '[';
+                    known.clear();
+                    all_zero = false;
+                    emit(*operation.body);
+                    flush();
+                    code += ']';
+                    known.clear();
+                    known[0] = 0;
+                    break;
+                }
+            }
+        }
+    }
+
+    static bool undoes(char first, char second) {
+        return (first == '<' && second == '>') ||
+                (first == '>' && second == '<') ||
+                (first == '+' && second == '-') ||
+                (first == '-' && second == '+');
+    }
+
+    // The value of a cell (relative to the pointer), if it's known
+    bool value_of(int offset, int &value) const {
+        auto cell = known.find(offset);
+        if(cell != known.end() && cell->second == unknown)
+            return false;
+        else if(cell != known.end())
+            value = cell->second;
+        else if(all_zero)
+            value = 0;
+        else
+            return false;
+        return true;
+    }
+
+    // Write out the straight-line code gathered so far, and finish with the
+    // pointer where it should be (which becomes the new origin)
+    void flush() {
+        vector<int> offsets;
+        for(auto &effect : effects) {
+            int value;
+            bool changes = effect.second.set ? !value_of(effect.first,
+                    value) || ((value - effect.second.value) & 255) :
+                    effect.second.value & 255;
+            if(changes)
+                offsets.push_back(effect.first);
+        }
+
+        // Sweep from one end of the cells changed to the other, starting
+        // from whichever end makes the whole trip shortest
+        if(!offsets.empty()) {
+            int low = offsets.front();
+            int high = offsets.back();
+            if(abs(low) + abs(high - position) > abs(high) +
+                    abs(low - position))
+                reverse(offsets.begin(), offsets.end());
+
+            range_low = low;
+            range_high = high;
+            for(int offset : offsets) {
+                travel(offset);
+                apply(offset, effects[offset]);
+            }
+        }
+
+        travel(position);
+        effects.clear();
+        move_origin(position);
+        position = 0;
+    }
+
+    void apply(int offset, const Effect &effect) {
+        int value = 0;
+        bool is_known = value_of(offset, value);
+        if(effect.set && !is_known) {
+            code += "[-]";
+            value = 0;
+            is_known = true;
+        }
+
+        int target = effect.set ? effect.value : value + effect.value;
+        if(is_known)
+            known[offset] = target & 255;
+        add(offset, target - value);
+    }
+
+    // Add to the cell under the pointer (with the given offset), in as few
+    // operators as possible
+    void add(int offset, int amount) {
+        amount &= 255;
+        int plain = min(amount, 256 - amount);
+        string best = amount < 128 ? string(amount, '+') :
+                string(256 - amount, '-');
+
+        // A loop in a neighbouring cell adds a product, and any remainder's
+        // added after it
+        for(int side : {1, -1}) {
+            int spare = offset + side;
+            int value;
+            if(spare < range_low || spare > range_high ||
+                    !value_of(spare, value) || value != 0)
+                continue;
+
+            string there = side > 0 ? ">" : "<";
+            string back = side > 0 ? "<" : ">";
+            for(int times = 2; times < plain; times += 1) {
+                for(int step = 2; times * step < 256 + 128 &&
+                        times + step + 7 < int(best.size()); step += 1) {
+                    for(int sign : {1, -1}) {
+                        int rest = (amount - sign * times * step) & 255;
+                        int extra = min(rest, 256 - rest);
+                        if(times + step + 7 + extra >= int(best.size()))
+                            continue;
+
+                        best = there + string(times, '+') + "[" + back +
+                                string(step, sign > 0 ? '+' : '-') + there +
+                                "-]" + back + (rest < 128 ? string(rest,
+                                '+') : string(256 - rest, '-'));
+                    }
+                }
+            }
+        }
+
+        code += best;
+    }
+
+    void travel(int offset) {
+        code += offset > cursor ? string(offset - cursor, '>') :
+                string(cursor - offset, '<');
+        cursor = offset;
+    }
+
+    // Make the given cell the origin, which is where the pointer is
+    void move_origin(int offset) {
+        map<int, int> moved;
+        for(auto &cell : known)
+            moved[cell.first - offset] = cell.second;
+        known = move(moved);
+        cursor = 0;
+    }
+
+    // The straight-line code not yet written, by cell, and where it leaves
+    // the pointer
+    map<int, Effect> effects;
+    int position = 0;
+
+    // Where the written code has left the pointer, while straight-line code
+    // is being written
+    int cursor = 0;
+
+    // The cells changed by the straight-line code being written, so cells
+    // used as scratch space are always ones the program visits anyway
+    int range_low = 0;
+    int range_high = 0;
+
+    // What's known of the cells, relative to the origin. Until the first
+    // loop, every cell's known to start at zero (apart from those read into)
+    static constexpr int unknown = -1;
+    map<int, int> known;
+    bool all_zero = true;
+};
+
+// The wide engine runs one program over many inputs in lockstep: cell n of
+// every instance sits side by side in one vector, so each operation is applied
+// to all of the instances at once. Lanes are 32 bytes wide to fill an AVX2
+// register (GCC's vector extensions lower them to narrower registers on
+// targets without AVX2)
+constexpr int lane_count = 32;
+typedef signed char Lanes __attribute__((vector_size(lane_count)));
+
+// A cell index for each lane
+typedef int LaneCells __attribute__((vector_size(lane_count * sizeof(int))));
+
+class WideRun {
+public:
+
+    // Each input file gets a lane (so there can be no more than lane_count)
+    WideRun(const vector<Operation> &program,
+            const vector<const MappedInput *> &inputs, int cell_limit) :
+            program(program), cell_limit(cell_limit), lanes(inputs.size()),
+            tape(64), origin(32) {
+        outputs.resize(lanes);
+        failures.resize(lanes);
+        for(int lane = 0; lane < lanes; lane += 1) {
+            input_cursors[lane] = inputs[lane]->begin;
+            input_ends[lane] = inputs[lane]->begin + inputs[lane]->size;
+        }
+    }
+
+    // Run the program on every lane, finishing any lanes which had to leave
+    // the lockstep on their own afterwards
+    void run() {
+        for(int lane = 0; lane < lanes; lane += 1)
+            live[lane] = -1;
+
+        execute(program, live);
+
+        // An error in a lane finished by the scalar engine ends just that
+        // lane. Its message is kept rather than shown straight away
+        for(Fallback &fallback : fallbacks) {
+            stringbuf error;
+            streambuf *standard_error = cerr.rdbuf(&error);
+            try {
+                resume(fallback.frames, fallback.state);
+            }
+            catch(...) {
+                failures[fallback.lane] = error.str();
+            }
+            cerr.rdbuf(standard_error);
+            outputs[fallback.lane] += fallback.output.str();
+        }
+    }
+
+    // What each lane printed, and why it stopped for any which failed (empty
+    // for those which finished)
+    vector<string> outputs;
+    vector<string> failures;
+
+    // How many lanes had to be finished by the scalar engine
+    int fallback_count() const {
+        return fallbacks.size();
+    }
+
+private:
+
+    // A lane which has left the lockstep, with everything needed to finish it
+    // separately
+    struct Fallback {
+        int lane;
+        State state;
+        vector<Frame> frames;
+        stringbuf output;
+    };
+
+    static bool any(const Lanes &mask) {
+        for(int lane = 0; lane < lane_count; lane += 1) {
+            if(mask[lane])
+                return true;
+        }
+
+        return false;
+    }
+
+    Lanes &cell(int offset = 0) {
+        return tape[origin + pointer + offset];
+    }
+
+    // Make sure the cells from the pointer to the pointer plus the extent
+    // exist, growing the tape (in either direction) when they don't
+    void reach(int extent) {
+        int low = min(pointer, pointer + extent);
+        int high = max(pointer, pointer + extent);
+
+        if(origin + low < 0) {
+            int growth = max<int>(tape.size(), -(origin + low));
+            tape.insert(tape.begin(), growth, Lanes{});
+            origin += growth;
+        }
+
+        if(origin + high >= int(tape.size()))
+            tape.resize(max<size_t>(2 * tape.size(), origin + high + 1));
+    }
+
+    // Track the cells used by the lanes in the mask, which the pointer has
+    // just moved for, as the scalar engine does. Any lane going past the limit
+    // stops there, and is taken out of the mask. A lane's extent always takes
+    // in cell 0, so greatest - lowest is the scalar engine's abs(greatest) +
+    // abs(lowest). Nothing needs doing while the pointer's within the cells
+    // every live lane has used already
+    void track_pointer(Lanes &mask) {
+        if(__builtin_expect(pointer >= common_lowest &&
+                pointer <= common_greatest, 1))
+            return;
+
+        LaneCells moved = __builtin_convertvector(mask, LaneCells);
+        LaneCells at = LaneCells{} + pointer;
+        lowest_cells = (moved & (at < lowest_cells)) ? at : lowest_cells;
+        greatest_cells = (moved & (at > greatest_cells)) ? at : greatest_cells;
+
+        Lanes exceeded = mask & __builtin_convertvector(greatest_cells -
+                lowest_cells > cell_limit, Lanes);
+        if(any(exceeded)) {
+            for(int lane = 0; lane < lanes; lane += 1) {
+                if(exceeded[lane])
+                    failures[lane] = "Stack size limit reached";
+            }
+            live &= ~exceeded;
+            mask &= ~exceeded;
+        }
+
+        common_lowest = INT_MIN;
+        common_greatest = INT_MAX;
+        for(int lane = 0; lane < lanes; lane += 1) {
+            if(live[lane]) {
+                common_lowest = max(common_lowest, lowest_cells[lane]);
+                common_greatest = min(common_greatest, greatest_cells[lane]);
+            }
+        }
+    }
+
+    // Take the lanes in the mask out of the lockstep, to be finished by the
+    // scalar engine. They carry on from the operation after `index` in the
+    // innermost block being run
+    void leave_lockstep(const Lanes &mask, size_t index) {
+        live &= ~mask;
+
+        for(int lane = 0; lane < lanes; lane += 1) {
+            if(!mask[lane])
+                continue;
+
+            fallbacks.emplace_back();
+            Fallback &fallback = fallbacks.back();
+            fallback.lane = lane;
+            fallback.frames = frames;
+            fallback.frames.back().index = index + 1;
+
+            State &state = fallback.state;
+            for(int position = 0; position < int(tape.size()); position += 1) {
+                if(tape[position][lane])
+                    state.stack[position - origin] = tape[position][lane];
+            }
+            state.pointer = pointer;
+            state.lowest_cell = lowest_cells[lane];
+            state.greatest_cell = greatest_cells[lane];
+            state.cell_limit = cell_limit;
+            state.input_cursor = input_cursors[lane];
+            state.input_end = input_ends[lane];
+            state.input_from_file = true;
+            state.output = &fallback.output;
+        }
+    }
+
+    char read_lane(int lane) {
+        if(input_cursors[lane] != input_ends[lane])
+            return *input_cursors[lane]++;
+        return 0;
+    }
+
+    void print_lane(int lane, char value) {
+        if(value < ' ' || value > '~')
+            value = '?';
+        outputs[lane] += value;
     }
 
-    return operator_count;
-}
+    // Run a block on the lanes in the mask (less any which leave the lockstep
+    // along the way)
+    void execute(const vector<Operation> &block, const Lanes &mask) {
+        Lanes active = mask;
+        frames.push_back({&block, 0});
 
-// Get input, with some error checking
-char get_input() {
-    cout << endl << "> ";
+        for(size_t index = 0; index < block.size(); index += 1) {
+            const Operation &operation = block[index];
+            frames.back().index = index;
 
-    string input;
-    getline(cin, input);
+            switch(operation.code) {
+                case Code::Add:
+                    cell() += active & (signed char)(operation.value);
+                    break;
 
-    if(!cin.good())
-        throw -1;
+                case Code::Set:
+                    cell() = (cell() & ~active) |
+                            (active & (signed char)(operation.value));
+                    break;
 
-    else if(input.empty()) {
-        cerr << "Input error";
-        throw -1;
+                case Code::Move:
+                    reach(operation.value);
+                    pointer += operation.value;
+                    track_pointer(active);
+                    break;
+
+                case Code::Print:
+                    for(int lane = 0; lane < lanes; lane += 1) {
+                        if(active[lane])
+                            print_lane(lane, cell()[lane]);
+                    }
+                    break;
+
+                case Code::Read:
+                    for(int lane = 0; lane < lanes; lane += 1) {
+                        if(active[lane])
+                            cell()[lane] = read_lane(lane);
+                    }
+                    break;
+
+                case Code::ReadBlock:
+                case Code::WriteBlock:
+                    reach(operation.offset + operation.value - 1);
+                    for(int lane = 0; lane < lanes; lane += 1) {
+                        if(!active[lane])
+                            continue;
+
+                        for(int cell_index = 0; cell_index < operation.value;
+                                cell_index += 1) {
+                            Lanes &target = cell(operation.offset +
+                                    cell_index);
+                            if(operation.code == Code::ReadBlock)
+                                target[lane] = read_lane(lane);
+                            else
+                                print_lane(lane, target[lane]);
+                        }
+                    }
+                    break;
+
+                // Lanes whose cell is zero skip (or leave) the loop, and wait
+                // for the others. That's only safe when the body's shifts
+                // cancel out, so every lane's pointer ends up in the same
+                // place: otherwise, lanes which stop while others carry on
+                // leave the lockstep
+                case Code::Loop: {
+                    auto balanced = balance.find(&operation);
+                    if(balanced == balance.end())
+                        balanced = balance.emplace(&operation,
+                                is_balanced(*operation.body)).first;
+
+                    Lanes running = active;
+                    while(true) {
+                        Lanes continuing = running & (cell() != 0);
+                        if(!any(continuing))
+                            break;
+
+                        if(!balanced->second && any(running & ~continuing))
+                            leave_lockstep(running & ~continuing, index);
+
+                        running = continuing;
+                        execute(*operation.body, running);
+                        running &= live;
+                    }
+
+                    active &= live;
+                    break;
+                }
+            }
+        }
+
+        frames.pop_back();
     }
 
-    return input[0];
-}
+    const vector<Operation> &program;
+    int cell_limit;
+    int lanes;
+
+    vector<Lanes> tape;
+    int origin;
+    int pointer = 0;
+    LaneCells lowest_cells = {};
+    LaneCells greatest_cells = {};
+    int common_lowest = 0;
+    int common_greatest = 0;
+
+    const char *input_cursors[lane_count];
+    const char *input_ends[lane_count];
+
+    // The lanes still running in lockstep
+    Lanes live = {};
+
+    vector<Frame> frames;
+    map<const Operation *, bool> balance;
+    deque<Fallback> fallbacks;
+};
+
+// Hardware counters for the TLB misses made while running a program (data and
+// instruction), through perf events. Where the kernel doesn't allow them, the
+// counters just aren't available
+class TlbCounters {
+public:
+    TlbCounters() {
+        descriptors[0] = open_counter(PERF_COUNT_HW_CACHE_DTLB);
+        descriptors[1] = open_counter(PERF_COUNT_HW_CACHE_ITLB);
+    }
+
+    ~TlbCounters() {
+        for(int descriptor : descriptors) {
+            if(descriptor != -1)
+                close(descriptor);
+        }
+    }
+
+    void start() {
+        for(int descriptor : descriptors) {
+            if(descriptor != -1) {
+                ioctl(descriptor, PERF_EVENT_IOC_RESET, 0);
+                ioctl(descriptor, PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+    }
+
+    void stop() {
+        for(int descriptor : descriptors) {
+            if(descriptor != -1)
+                ioctl(descriptor, PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+
+    // The misses counted, or -1 where the counter isn't available
+    long data_misses() const {
+        return count(descriptors[0]);
+    }
+
+    long instruction_misses() const {
+        return count(descriptors[1]);
+    }
+
+private:
+    static int open_counter(int cache) {
+        perf_event_attr attributes = {};
+        attributes.size = sizeof attributes;
+        attributes.type = PERF_TYPE_HW_CACHE;
+        attributes.config = cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        attributes.disabled = 1;
+        attributes.exclude_kernel = 1;
+        attributes.exclude_hv = 1;
+
+        return syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0);
+    }
+
+    static long count(int descriptor) {
+        long value;
+        if(descriptor == -1 || read(descriptor, &value, sizeof value) !=
+                sizeof value)
+            return -1;
+        return value;
+    }
+
+    int descriptors[2];
+};
+
+// A program kept up to date with its source file as it's edited. Each
+// top-level loop is known by a hash of its source: a loop which hasn't
+// changed since the last version keeps its parsed, canonicalized and
+// interned body, and only the loops which have changed are parsed again.
+// Bodies are interned against every version so far, so a changed loop can
+// still share the bodies of those which haven't
+class WatchedProgram {
+public:
+    explicit WatchedProgram(const string &file_name) : file_name(file_name) {
+        size_t slash = file_name.rfind('/');
+        string directory = slash == string::npos ? "." :
+                file_name.substr(0, slash + 1);
+        base_name = file_name.substr(slash + 1);
+
+        // The directory's watched, rather than the file, as editors often
+        // save by replacing the file with a new one
+        descriptor = inotify_init1(IN_CLOEXEC);
+        if(descriptor == -1 || inotify_add_watch(descriptor,
+                directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) == -1) {
+            cerr << "Couldn't watch file: " << file_name;
+            throw -1;
+        }
+    }
+
+    WatchedProgram(const WatchedProgram &) = delete;
+    WatchedProgram &operator=(const WatchedProgram &) = delete;
+
+    ~WatchedProgram() {
+        close(descriptor);
+    }
+
+    // Read the source again, and bring the instructions and program up to
+    // date with it. Returns the number of top-level loops parsed again
+    size_t reload(string &instructions, vector<Operation> &program) {
+        ifstream file(file_name);
+        if(!file.is_open()) {
+            cerr << "Couldn't open file: " << file_name;
+            throw -1;
+        }
+        instructions.assign(istreambuf_iterator<char>(file),
+                istreambuf_iterator<char>());
+
+        vector<Operation> latest = parse(instructions, matches);
+        vector<uint64_t> hashes;
+        size_t changed = 0;
+        for(const Operation &operation : latest) {
+            if(operation.code != Code::Loop || operation.value < 0)
+                continue;
+
+            uint64_t hash = hash_operators(operation.unparsed_begin,
+                    operation.unparsed_end);
+            hashes.push_back(hash);
+
+            auto known = loops.find(hash);
+            if(known != loops.end())
+                operation.body = known->second;
+            else {
+                parse_body(operation);
+                parse_all(*operation.body);
+                changed += 1;
+            }
+        }
+
+        if(!bodies)
+            bodies.reset(new BodyTable(count(instructions.begin(),
+                    instructions.end(), '[')));
+        bodies->intern(latest);
+
+        // Only the last version's loops are kept to be compared with the next
+        loops.clear();
+        size_t index = 0;
+        for(const Operation &operation : latest) {
+            if(operation.code == Code::Loop && operation.value >= 0)
+                loops[hashes[index ++]] = operation.body;
+        }
+
+        top_level_loops = hashes.size();
+        program = move(latest);
+        return changed;
+    }
+
+    // Wait for the file to be written. A save often comes as several
+    // events, so any which follow closely are taken along with it
+    void wait() {
+        char events[4096] __attribute__((aligned(__alignof__(inotify_event))));
+        bool written = false;
+        int timeout = -1;
+
+        while(true) {
+            pollfd waiting = {descriptor, POLLIN, 0};
+            int ready = poll(&waiting, 1, timeout);
+            if(ready < 0 && errno == EINTR)
+                continue;
+            if(ready < 0) {
+                cerr << "Couldn't watch file: " << file_name;
+                throw -1;
+            }
+            if(ready == 0)
+                return;
+
+            ssize_t size = read(descriptor, events, sizeof events);
+            for(ssize_t offset = 0; offset < size;) {
+                const inotify_event *event =
+                        reinterpret_cast<const inotify_event *>(events +
+                        offset);
+                if(event->len && base_name == event->name)
+                    written = true;
+                offset += sizeof(inotify_event) + event->len;
+            }
+
+            if(written)
+                timeout = 50;
+        }
+    }
+
+    // The number of loops at the top level of the last version
+    size_t top_level_loops = 0;
+
+private:
+    string file_name;
+    string base_name;
+    int descriptor;
+    unique_ptr<BodyTable> bodies;
+    unordered_map<uint64_t, shared_ptr<const vector<Operation>>> loops;
+    vector<int> matches;
+};
 
 int main(int argument_count, char *argument_vector[]) {
 
+    // Route standard output through a large buffer (restored before returning,
+    // so that cout is never left pointing at a destroyed buffer)
+    OutputBuffer output_buffer(STDOUT_FILENO);
+    streambuf *standard_buffer = cout.rdbuf(&output_buffer);
+    unique_ptr<OutputRing> output_ring;
+    int exit_code = 0;
+
     // For readability's sake, add a newline
     cout << endl;
 
@@ -76,8 +3926,29 @@ int main(int argument_count, char *argument_vector[]) {
 
         // Declare the user-define-able variables
         bool verbose = false;
+        bool threaded_output = false;
+        Engine engine = Engine::Switch;
+        bool engine_given = false;
+        bool estimate_only = false;
+        bool stream_program = false;
+        long code_budget = -1;
+        bool huge_pages = false;
+        bool count_tlb_misses = false;
+        long ring_cells = 0;
+        Overflow overflow = Overflow::Wrap;
+        string record_file;
+        string replayed_input;
+        bool replaying = false;
+        bool raw_input = false;
+        bool repl = false;
+        bool watch = false;
+        size_t memo_capacity = 0;
+        bool emit_brainfuck = false;
+        string program_file;
         string output_file;
         int cell_limit = 256;
+        vector<unique_ptr<MappedInput>> input_files;
+        vector<string> input_names;
 
         // Start the timer
         auto start_time = chrono::system_clock::now();
@@ -88,10 +3959,53 @@ int main(int argument_count, char *argument_vector[]) {
 
         // Parse the command line arguments
         // -f [file name] specify an input file
+        // -i [file name] read the program's input from a file, instead of
+        // prompting for it (',' sets the cell to zero once the file runs out).
+        // Given more than once, the program is run once per file, with the
+        // runs made in lockstep by the wide engine
         // -l [cell limit] limit the number of cells which the program can use
-        // (default 128)
+        // (default 256)
         // -v specify that the output should be verbose (shows information about
         // the program)
+        // -w write output from a separate thread, so running the program never
+        // waits on the terminal or pipe
+        // --engine=[switch|threaded|auto] choose how the program is run (auto
+        // picks whichever is expected to finish soonest, learning from
+        // earlier runs, and is the REPL's default, choosing for each entry)
+        // -s read the program from standard input, running it as it arrives
+        // (',' then needs an input file, and otherwise reads zeroes)
+        // --estimate print bounds on the operations the program will perform
+        // and the cells it will use, without running it
+        // --code-budget=[bytes] limit the memory held by the loop bodies the
+        // switch engine parses as loops are entered (past the budget, the
+        // least recently used are dropped, and parsed again if needed)
+        // --huge-pages back the tape, and the threaded engine's code, with
+        // huge pages where the system allows
+        // --perf count the TLB misses made while running (shown in verbose
+        // mode)
+        // --tape=ring:[cells] use a fixed tape of that many cells (rounded up
+        // to a power of two), which wraps round, with no growth or cell limit
+        // --overflow=[wrap|saturate|trap] choose what happens when a cell's
+        // taken past 0 or 255: it wraps round (the default), sticks there, or
+        // stops the program with an error
+        // --record [file name] log each byte typed in (with when it was
+        // typed, and where in the output its prompt came)
+        // --replay [file name] take the program's input from a recording,
+        // instead of prompting for it (as from an input file)
+        // --repl run instructions a line at a time as they're typed, keeping
+        // the tape between lines (:pointer, :cells, :time and :quit look at
+        // the state)
+        // --watch run the program file again each time it's saved, parsing
+        // only the top-level loops which changed, and timing each run against
+        // the last
+        // --memo[=bytes] answer runs made before from a store of finished
+        // runs (by program, input and options), held to the given size (64
+        // MiB by default). Only runs whose input is all known up front are
+        // kept
+        // --emit=bf print the program as minimal brainfuck (for other
+        // interpreters), rather than running it
+        // --raw read each key as it's pressed (with no prompt, and no echo),
+        // rather than a line at a time
         for(int index = 1; index < argument_count; ++ index) {
 
             string argument = argument_vector[index];
@@ -105,6 +4019,7 @@ int main(int argument_count, char *argument_vector[]) {
 
                 index += 1;
                 string file_name = argument_vector[index];
+                program_file = file_name;
                 ifstream file(file_name);
                 if(!file.is_open()) {
                     cerr << "Couldn't open file: " << file_name;
@@ -119,6 +4034,18 @@ int main(int argument_count, char *argument_vector[]) {
                 file.close();
             }
 
+            // Map the program's input file(s)
+            else if(argument == "-i") {
+                if(index + 1 >= argument_count) {
+                    cerr << "No file provided after input flag";
+                    throw -1;
+                }
+
+                index += 1;
+                input_names.push_back(argument_vector[index]);
+                input_files.emplace_back(new MappedInput(input_names.back()));
+            }
+
             // Handle a provided cell limit
             else if(argument == "-l") {
                 if(index + 1 >= argument_count) {
@@ -140,6 +4067,143 @@ int main(int argument_count, char *argument_vector[]) {
             else if(argument == "-v")
                 verbose = true;
 
+            // Handle the threaded output flag
+            else if(argument == "-w")
+                threaded_output = true;
+
+            // Handle the streaming flag
+            else if(argument == "-s")
+                stream_program = true;
+
+            // Handle the estimate flag
+            else if(argument == "--estimate")
+                estimate_only = true;
+
+            // Handle the engine choice
+            else if(argument.compare(0, 9, "--engine=") == 0) {
+                string name = argument.substr(9);
+                if(name == "switch")
+                    engine = Engine::Switch;
+                else if(name == "threaded")
+                    engine = Engine::Threaded;
+                else if(name == "auto")
+                    engine = Engine::Automatic;
+                else {
+                    cerr << "Unknown engine: " << name;
+                    throw -1;
+                }
+                engine_given = true;
+            }
+
+            else if(argument == "--huge-pages")
+                huge_pages = true;
+
+            else if(argument == "--perf")
+                count_tlb_misses = true;
+
+            // Handle the code budget
+            else if(argument.compare(0, 14, "--code-budget=") == 0) {
+                try {
+                    code_budget = stol(argument.substr(14));
+                }
+                catch(...) {
+                    cerr << "Code budget value non-parse-able";
+                    throw -1;
+                }
+
+                if(code_budget < 0) {
+                    cerr << "Code budget value non-parse-able";
+                    throw -1;
+                }
+            }
+
+            // Handle the tape choice
+            else if(argument.compare(0, 12, "--tape=ring:") == 0) {
+                try {
+                    ring_cells = stol(argument.substr(12));
+                }
+                catch(...) {
+                    ring_cells = 0;
+                }
+
+                if(ring_cells <= 0 || ring_cells > (1 << 30)) {
+                    cerr << "Ring tape size non-parse-able";
+                    throw -1;
+                }
+            }
+
+            // Handle the REPL flag
+            else if(argument == "--repl")
+                repl = true;
+
+            // Handle the watch flag
+            else if(argument == "--watch")
+                watch = true;
+
+            // Handle the memo store, and its size
+            else if(argument == "--memo")
+                memo_capacity = 64 << 20;
+            else if(argument.compare(0, 7, "--memo=") == 0) {
+                long capacity = 0;
+                try {
+                    capacity = stol(argument.substr(7));
+                }
+                catch(...) {
+                    capacity = 0;
+                }
+
+                if(capacity <= 0) {
+                    cerr << "Memo size non-parse-able";
+                    throw -1;
+                }
+                memo_capacity = capacity;
+            }
+
+            // Handle the output format
+            else if(argument.compare(0, 7, "--emit=") == 0) {
+                if(argument.substr(7) != "bf") {
+                    cerr << "Unknown output format: " << argument.substr(7);
+                    throw -1;
+                }
+                emit_brainfuck = true;
+            }
+
+            // Handle the raw input flag
+            else if(argument == "--raw")
+                raw_input = true;
+
+            // Record the input typed in, or replay a recording
+            else if(argument == "--record" || argument == "--replay") {
+                if(index + 1 >= argument_count) {
+                    cerr << "No file provided after " << argument << " flag";
+                    throw -1;
+                }
+
+                index += 1;
+                if(argument == "--record")
+                    record_file = argument_vector[index];
+                else {
+                    replayed_input = InputRecording::replay(
+                            argument_vector[index]);
+                    replaying = true;
+                }
+            }
+
+            // Handle the overflow policy
+            else if(argument.compare(0, 11, "--overflow=") == 0) {
+                string name = argument.substr(11);
+                if(name == "wrap")
+                    overflow = Overflow::Wrap;
+                else if(name == "saturate")
+                    overflow = Overflow::Saturate;
+                else if(name == "trap")
+                    overflow = Overflow::Trap;
+                else {
+                    cerr << "Unknown overflow policy: " << name;
+                    throw -1;
+                }
+            }
+
             // If it isn't a flag, and the instructions aren't empty, that means
             // a file has already been loaded as the instruction set -- and
             // the user shouldn't have also provided instructions as an
@@ -155,167 +4219,575 @@ int main(int argument_count, char *argument_vector[]) {
                 instructions += argument;
         }
 
-        // The stack and pointer are central to brainfuck functionality, it's
-        // the pseudo-memory which is manipulated by the code the user provides
-        map<int, char> stack;
-        int pointer = 0;
+        if(threaded_output) {
+            output_ring.reset(new OutputRing(STDOUT_FILENO));
+            output_buffer.set_ring(output_ring.get());
+        }
 
-        // Stores the indices of opening brackets encountered while running
-        // the instructions
-        vector<int> loop_start_indices;
+        // A streamed program is only ever seen a piece at a time, so it can
+        // only be run on its own, by the switch engine
+        if(stream_program && (!instructions.empty() || estimate_only ||
+                input_files.size() > 1 || engine != Engine::Switch)) {
+            cerr << "Streamed programs can't be combined with other " <<
+                    "instructions, estimates, several inputs or other engines";
+            throw -1;
+        }
 
-        // Declare some variables used when the verbosity flag is set
-        int lowest_cell = 0;
-        int greatest_cell = 0;
-        int operations = 0;
-        int left_shifts = 0;
-        int right_shifts = 0;
-
-        // Handle each instruction
-        char instruction;
-        for(int index = 0; index < instructions.size(); index += 1) {
-            instruction = instructions[index];
-
-            // Increment the number of operations performed (reported in verbose
-            // mode)
-            operations += 1;
-
-            // Check the number of cells being used doesn't exceed the limit
-            // (which could indicate that there's an endless loop)
-            if(abs(greatest_cell) + abs(lowest_cell) > cell_limit) {
-                cerr << "Stack size limit reached";
-                throw -1;
-            }
+        // A replay stands in for input typed in (or for reading zeroes, in a
+        // streamed program), and only input typed in is recorded
+        if(!input_files.empty() && (!record_file.empty() || replaying)) {
+            cerr << "Recordings can't be combined with input files";
+            throw -1;
+        }
+        if(!record_file.empty() && (replaying || stream_program)) {
+            cerr << "Only input typed in can be recorded";
+            throw -1;
+        }
 
-            // Increment or decrement the value of the current cell
-            if(instruction == '+')
-                stack[pointer] += 1;
-            else if(instruction == '-')
-                stack[pointer] -= 1;
-
-            // Increment or decrement the cell pointer
-            else if(instruction == '>') {
-                pointer += 1;
-                right_shifts += 1;
-                lowest_cell = min(pointer, lowest_cell);
-            }
-            else if(instruction == '<') {
-                pointer -= 1;
-                left_shifts += 1;
-                greatest_cell = max(pointer, greatest_cell);
-            }
-
-            // Write the value of the current cell (or just the integer value of
-            // the cell, if it's outside the ASCII character range)
-            // TODO: Decide whether to ignore such output, because it
-            // technically goes against specification
-            else if(instruction == '.') {
-                char output;
-                if(stack[pointer] < ' ' || stack[pointer] > '~')
-                    output ='?';
-                else
-                    output = stack[pointer];
+        // The REPL reads its instructions from standard input, a line at a
+        // time, and runs each on its own
+        if(repl && (!instructions.empty() || stream_program ||
+                estimate_only || input_files.size() > 1 || raw_input)) {
+            cerr << "The REPL can't be combined with other instructions, " <<
+                    "streaming, estimates, several inputs or raw input";
+            throw -1;
+        }
+        if(repl && !engine_given)
+            engine = Engine::Automatic;
 
-                cout << output;
-            }
+        // Watching reruns a program file, as a single run, with every loop
+        // parsed up front
+        if(watch && (program_file.empty() || stream_program || estimate_only ||
+                input_files.size() > 1 || repl || code_budget >= 0)) {
+            cerr << "Watching needs a program file, and can't be combined " <<
+                    "with streaming, estimates, several inputs, the REPL " <<
+                    "or a code budget";
+            throw -1;
+        }
+
+        // Raw input is read from the terminal, as it's typed
+        if(raw_input && (!input_files.empty() || replaying ||
+                stream_program)) {
+            cerr << "Raw input can't be combined with input files, " <<
+                    "replays or streamed programs";
+            throw -1;
+        }
+
+        // Several inputs are run by the wide engine, on tapes of its own
+        // (which always wrap), and estimates assume cells wrap
+        if(ring_cells > 0 && input_files.size() > 1) {
+            cerr << "A ring tape can't be used with several inputs";
+            throw -1;
+        }
+        if(overflow != Overflow::Wrap && (input_files.size() > 1 ||
+                estimate_only || emit_brainfuck)) {
+            cerr << "Only wrapping cells can be used with several inputs, " <<
+                    "estimates or emitted brainfuck";
+            throw -1;
+        }
+
+        // Emitting brainfuck replaces running the program
+        if(emit_brainfuck && (stream_program || estimate_only || repl ||
+                watch)) {
+            cerr << "Brainfuck can't be emitted from streamed programs, " <<
+                    "estimates, the REPL or watch mode";
+            throw -1;
+        }
+
+        // Translate the instructions. Only the switch engine can work with
+        // loops which haven't been parsed yet
+        // Large programs are parsed and lowered across several threads
+        // A watched program is read by the watcher, which parses every loop
+        // (and reuses what it can, as the file's edited)
+        vector<Operation> program;
+        vector<int> matches;
+        unique_ptr<WatchedProgram> watched;
+        size_t changed_loops = 0;
+        if(watch) {
+            watched.reset(new WatchedProgram(program_file));
+            changed_loops = watched->reload(instructions, program);
+        }
+        else
+            program = parse(instructions, matches);
+
+        bool parallel = instructions.size() > (1 << 20);
+        if(!watch && (engine != Engine::Switch || estimate_only ||
+                input_files.size() > 1 || emit_brainfuck)) {
+            if(parallel)
+                parse_all_parallel(program);
+            else
+                parse_all(program);
+
+            intern_loops(program,
+                    count(instructions.begin(), instructions.end(), '['));
+        }
+        long operator_count = count_operators(instructions);
+
+        // Runs are only memoized when everything they'll read is known up
+        // front: from input files, a replay, or no input at all
+        unique_ptr<MemoStore> memo;
+        if(memo_capacity > 0 && !estimate_only && !stream_program && !repl &&
+                !watch && !raw_input && (!input_files.empty() || replaying ||
+                instructions.find(',') == string::npos))
+            memo.reset(new MemoStore(memo_capacity));
+
+        // Print what can be worked out about the program, instead of running
+        // it
+        if(estimate_only) {
+            EngineHistory history;
+            Estimate estimate = estimate_program(program, 1000000, &history,
+                    hash_program(instructions));
+            cout << fixed;
+            cout.precision(0);
 
-            // Get user input
-            else if(instruction == ',')
-                stack[pointer] = get_input();
+            cout << "Operations:            ";
+            if(estimate.never_finishes)
+                cout << "at least " << estimate.fewest_operations <<
+                        " (never finishes)";
+            else if(isinf(estimate.most_operations))
+                cout << "at least " << estimate.fewest_operations;
+            else if(estimate.most_operations == estimate.fewest_operations)
+                cout << estimate.fewest_operations << " exactly";
+            else
+                cout << estimate.fewest_operations << " to " <<
+                        estimate.most_operations;
+            cout << endl;
+
+            cout << "Cells reached:         ";
+            if(estimate.unbounded_left)
+                cout << "unbounded";
+            else
+                cout << estimate.lowest_cell;
+            cout << " : ";
+            if(estimate.unbounded_right)
+                cout << "unbounded";
+            else
+                cout << estimate.greatest_cell;
+            cout << endl;
 
-            // Handle loop start characters
-            else if(instruction == '[') {
+            cout << "Expected operations:   " <<
+                    estimate.expected_operations << (estimate.
+                    expected_from_history ? " (as last run)" : "") << endl <<
+                    endl;
+        }
+
+        // Print the program back out as brainfuck, minified
+        else if(emit_brainfuck) {
+            string code = Minifier(program).code;
+            cout << code << endl << endl;
 
-                // If the cell is zero, execution needs to jump to the
-                // corresponding closing bracket
-                if(stack[pointer] == 0) {
-                    int indentation = 1;
+            if(verbose)
+                cout << "Operator count:        " << operator_count <<
+                        " (" << code.size() << " emitted)" << endl << endl;
+        }
 
-                    // Handle any internally nested brackets
-                    while(indentation) {
-                        index += 1;
-                        instruction = instructions[index];
+        // With several input files, run the program on all of them in groups
+        // of lockstep lanes, then print what each run printed in turn
+        else if(input_files.size() > 1) {
+            int fallback_count = 0;
 
-                        if(instructions[index] == '[')
-                            indentation += 1;
-                        else if(instructions[index] == ']')
-                            indentation -= 1;
+            // Runs kept in the memo store are taken from there, and only the
+            // rest are run
+            vector<string> outputs(input_files.size());
+            vector<string> failures(input_files.size());
+            vector<uint64_t> keys(input_files.size());
+            vector<size_t> unknown;
+            uint64_t program_hash = memo ? hash_program(instructions) : 0;
+            for(size_t file = 0; file < input_files.size(); file += 1) {
+                MemoStore::Run kept;
+                if(memo) {
+                    const MappedInput &input = *input_files[file];
+                    keys[file] = MemoStore::key(program_hash,
+                            hash_bytes(input.begin, input.begin + input.size),
+                            cell_limit, ring_cells, overflow);
+                    if(memo->recall(keys[file], kept, false)) {
+                        outputs[file] = move(kept.output);
+                        continue;
                     }
                 }
-
-                // If the cell's value is non-zero, the index of this loop-
-                // starting bracket needs to be added to the loop start index
-                // buffer, so it can be jumped back to later
-                else if(loop_start_indices.empty() ||
-                        (!loop_start_indices.empty() &&
-                        loop_start_indices.back() != index))
-                    loop_start_indices.push_back(index);
+                unknown.push_back(file);
             }
 
-            // Handle closing brackets
-            else if(instruction == ']') {
+            for(size_t first = 0; first < unknown.size();
+                    first += lane_count) {
+                size_t last = min(unknown.size(), first + lane_count);
+                vector<const MappedInput *> inputs;
+                for(size_t index = first; index < last; index += 1)
+                    inputs.push_back(input_files[unknown[index]].get());
 
-                // If the cell's value is non-zero, jump back to the last
-                // starting bracket
-                if(stack[pointer]) {
-                    if(!loop_start_indices.empty())
-                        index = loop_start_indices.back();
+                WideRun run(program, inputs, cell_limit);
+                run.run();
+                fallback_count += run.fallback_count();
 
-                    // The buffer should never be empty (in this instance),
-                    // this indicates a syntax error
-                    else {
-                        cout << "Syntax error";
-                        throw -1;
+                for(size_t index = first; index < last; index += 1) {
+                    size_t file = unknown[index];
+                    outputs[file] = move(run.outputs[index - first]);
+                    failures[file] = move(run.failures[index - first]);
+                    if(memo && failures[file].empty()) {
+                        MemoStore::Run kept;
+                        kept.output = outputs[file];
+                        memo->store(keys[file], kept);
                     }
                 }
+            }
 
-                // Otherwise, remove the last starting bracket stored from the
-                // open bracket buffer
-                else
-                    loop_start_indices.pop_back();
+            // A run which failed is shown with why, and fails the batch as a
+            // whole once the rest have been shown
+            for(size_t file = 0; file < input_files.size(); file += 1) {
+                cout << input_names[file] << ": " << outputs[file];
+                if(!failures[file].empty()) {
+                    cout << " (failed: " << failures[file] << ")";
+                    exit_code = -1;
+                }
+                cout << endl;
+            }
+
+            cout << endl;
+
+            if(verbose) {
+                auto end_time = chrono::system_clock::now();
+                chrono::duration<double> elapsed_time = end_time - start_time;
+                cout.precision(3);
+                cout << "Runs:                  " << input_files.size() <<
+                        " (" << fallback_count <<
+                        " finished outside the lockstep)" << endl;
+                if(memo)
+                    cout << "Memo hits:             " << memo->hits <<
+                            " of " << memo->lookups << " runs" << endl;
+                cout << "Time taken:            " << elapsed_time.count() <<
+                        "s" << endl << endl;
             }
         }
 
-        // Add some new-lines for readability
-        cout << endl << endl;
+        else {
+            // How long the last run took (from lowering the program), and what
+            // it performed
+            chrono::duration<double> run_time(0);
+            long run_operations = 0;
+
+            // The run's the same for either kind of tape, and made once for
+            // whichever was asked for
+            auto run_program = [&](auto &state) {
+                state.cell_limit = cell_limit;
+                state.output = &output_buffer;
+                if(!input_files.empty()) {
+                    state.input_cursor = input_files.front()->begin;
+                    state.input_end = input_files.front()->begin +
+                            input_files.front()->size;
+                    state.input_from_file = true;
+                }
+                else if(replaying) {
+                    state.input_cursor = replayed_input.data();
+                    state.input_end = replayed_input.data() +
+                            replayed_input.size();
+                    state.input_from_file = true;
+                }
+                else if(stream_program)
+                    state.input_from_file = true;
+
+                unique_ptr<InputRecording> recording;
+                if(!record_file.empty()) {
+                    recording.reset(new InputRecording(record_file));
+                    state.recording = recording.get();
+                }
+
+                unique_ptr<RawTerminal> terminal;
+                if(raw_input) {
+                    terminal.reset(new RawTerminal());
+                    state.terminal = terminal.get();
+                }
+
+                // A run made before is answered from the memo store, with
+                // nothing run at all. Otherwise a copy of its output is kept,
+                // to store the run once it's finished
+                MemoStore::Run kept;
+                uint64_t memo_key = 0;
+                bool remembered = false;
+                unique_ptr<CopyingBuffer> copying;
+                if(memo) {
+                    uint64_t input_hash = state.input_from_file ?
+                            hash_bytes(state.input_cursor, state.input_end) :
+                            0;
+                    memo_key = MemoStore::key(hash_program(instructions),
+                            input_hash, cell_limit, ring_cells, overflow);
+                    remembered = memo->recall(memo_key, kept, true);
+                    if(!remembered) {
+                        copying.reset(new CopyingBuffer(state.output,
+                                memo_capacity));
+                        state.output = copying.get();
+                    }
+                }
+
+                const char *code_backing = nullptr;
+
+                unique_ptr<CodeCache> code_cache;
+                if(code_budget >= 0) {
+                    code_cache.reset(new CodeCache(code_budget));
+                    state.code_cache = code_cache.get();
+                }
+
+                // Leave the choice to the cost model, if asked to. It's made
+                // afresh for each run, as a watched program changes. A
+                // streamed program only runs on the switch engine, the REPL
+                // makes its own choice for each entry, and a remembered run
+                // isn't run at all
+                Engine chosen = stream_program ? Engine::Switch : engine;
+                bool automatic = engine == Engine::Automatic &&
+                        !stream_program && !repl && !remembered;
+                uint64_t program_hash = 0;
+                double expected_operations = 0;
+                unique_ptr<EngineHistory> history;
+                if(automatic) {
+                    history.reset(new EngineHistory());
+                    program_hash = hash_program(instructions);
+                    chosen = choose_engine(program, operator_count,
+                            program_hash, *history, expected_operations);
+                }
+
+                unique_ptr<TlbCounters> tlb_counters;
+                if(count_tlb_misses)
+                    tlb_counters.reset(new TlbCounters());
+
+                auto run_start = chrono::steady_clock::now();
+                auto lowered = run_start;
+                size_t lowered_size = 0;
+
+                if(remembered) {
+                    state.output->sputn(kept.output.data(),
+                            kept.output.size());
+                    state.operations = kept.operations;
+                    state.lowest_cell = kept.lowest_cell;
+                    state.greatest_cell = kept.greatest_cell;
+                    state.left_shifts = kept.left_shifts;
+                    state.right_shifts = kept.right_shifts;
+                    state.characters_printed = kept.output.size();
+                }
+                else if(stream_program)
+                    operator_count = run_stream(STDIN_FILENO, state);
+                else if(repl)
+                    operator_count = run_repl(state, engine);
+                else if(chosen == Engine::Threaded) {
+                    ThreadedProgram threaded(program, parallel);
+                    lowered_size = threaded.size();
+                    if(huge_pages)
+                        code_backing = threaded.use_huge_pages();
+                    lowered = chrono::steady_clock::now();
+
+                    if(tlb_counters)
+                        tlb_counters->start();
+                    threaded.run(state);
+                }
+                else {
+                    if(tlb_counters)
+                        tlb_counters->start();
+                    execute(program, state);
+                }
+                if(tlb_counters)
+                    tlb_counters->stop();
+
+                auto run_end = chrono::steady_clock::now();
+                run_time = run_end - run_start;
+                run_operations = state.operations;
+
+                if(copying) {
+                    copying->pubsync();
+                    if(copying->complete) {
+                        kept.has_statistics = true;
+                        kept.operations = state.operations;
+                        kept.lowest_cell = state.lowest_cell;
+                        kept.greatest_cell = state.greatest_cell;
+                        kept.left_shifts = state.left_shifts;
+                        kept.right_shifts = state.right_shifts;
+                        kept.output = move(copying->copy);
+                        memo->store(memo_key, kept);
+                    }
+                }
+
+                if(automatic) {
+                    chrono::duration<double> lowering_time =
+                            lowered - run_start;
+                    chrono::duration<double> run_time = run_end - lowered;
+                    history->record(chosen, program_hash, state.operations,
+                            run_time.count(), lowered_size,
+                            lowering_time.count());
+                }
+
+                // Add some new-lines for readability
+                cout << endl << endl;
+
+                // If verbosity was specified, print out some statistics
+                if(verbose) {
+
+                    // Display the number of operators in the string
+                    cout << "Operator count:        " << operator_count << endl;
+
+                    cout << "Operations performed:  " << state.operations <<
+                            endl;
+                    cout << "Engine:                ";
+                    if(remembered)
+                        cout << "memo (answered from an earlier run)";
+                    else if(repl && engine == Engine::Automatic)
+                        cout << "threaded for entries with loops, switch " <<
+                                "for the rest";
+                    else
+                        cout << engine_name(chosen);
+                    if(automatic)
+                        cout << " (chosen expecting " << expected_operations <<
+                                " operations)";
+                    cout << endl;
+                    // A ring tape's extent isn't tracked (its pointer wraps
+                    // round), so its size is shown instead
+                    if constexpr(decltype(state.stack)::bounded)
+                        cout << "Cells used:            " <<
+                                abs(state.greatest_cell) +
+                                abs(state.lowest_cell) + 1 << " (" <<
+                                state.lowest_cell << " : " <<
+                                state.greatest_cell << ")" << endl;
+                    else
+                        cout << "Cells used:            " <<
+                                state.stack.size() << " (ring)" << endl;
+                    cout << "Shift operations:      " << state.left_shifts +
+                            state.right_shifts << " (" << state.left_shifts <<
+                            " left, " << state.right_shifts << " right)" <<
+                            endl;
+                    if(huge_pages) {
+                        cout << "Tape backing:          " <<
+                                state.stack.backing << endl;
+                        if(code_backing)
+                            cout << "Code backing:          " << code_backing <<
+                                    endl;
+                    }
+                    if(tlb_counters) {
+                        cout << "TLB misses:            ";
+                        if(tlb_counters->data_misses() < 0)
+                            cout << "unavailable" << endl;
+                        else
+                            cout << tlb_counters->data_misses() << " data, " <<
+                                    tlb_counters->instruction_misses() <<
+                                    " instruction" << endl;
+                    }
+                    if(memo)
+                        cout << "Memo hits:             " << memo->hits <<
+                                " of " << memo->lookups << " runs" << endl;
+                    if(code_cache)
+                        cout << "Code resident:         " <<
+                                code_cache->resident_bytes << " bytes (peak " <<
+                                code_cache->peak_bytes << ", " <<
+                                code_cache->evictions << " evictions)" << endl;
 
-        // If verbosity was specified, print out some statistics
-        if(verbose) {
+                    // Calculate how long the program took to run, and the
+                    // average number of operations performed per second
+                    // TODO: Find a way to make these results more repeatable
+                    // -- maybe also give feedback on which operators took the
+                    // most time to complete, or a breakdown of which loops
+                    // took the longest
+                    auto end_time = chrono::system_clock::now();
+                    chrono::duration<double> elapsed_time =
+                            end_time - start_time;
+                    float time_in_seconds =  elapsed_time.count() *
+                            chrono::seconds::period::num /
+                            chrono::seconds::period::den;
+                    cout.precision(3);
+                    cout << "Time taken:            " << time_in_seconds <<
+                            "s" << endl;
+                    // A remembered run performed none of its operations
+                    if(!remembered)
+                        cout << "Operations per second: " <<
+                                state.operations / time_in_seconds << endl;
+                    cout << "Characters printed:    " <<
+                            state.characters_printed << endl;
+                    cout << "Output throughput:     " <<
+                            state.characters_printed / time_in_seconds /
+                            (1 << 20) << " MiB/s" << endl << endl;
+                }
+            };
+
+            // With the tape and overflow policy asked for
+            auto run_with = [&](auto arithmetic) {
+                typedef decltype(arithmetic) Arithmetic;
+                if(ring_cells > 0) {
+                    BasicState<RingTape, Arithmetic> state;
+                    state.stack.resize(ring_cells, huge_pages);
+                    run_program(state);
+                }
+                else {
+                    BasicState<Tape, Arithmetic> state;
+                    state.stack.huge_pages = huge_pages;
+                    run_program(state);
+                }
+            };
 
-            // Count and display the number of operators in the string
-            int operator_count = count_operators(instructions);
-            cout << "Operator count:        " << operator_count << endl;
+            auto run_once = [&]() {
+                if(overflow == Overflow::Saturate)
+                    run_with(Saturate());
+                else if(overflow == Overflow::Trap)
+                    run_with(Trap());
+                else
+                    run_with(Wrap());
+            };
+
+            if(!watch)
+                run_once();
+
+            // Run each version of a watched program as it's saved, and
+            // compare it with the last version which ran
+            double last_time = -1;
+            long last_operations = 0;
+            for(int version = 1; watch; version += 1) {
+                bool ran = true;
+                try {
+                    run_once();
+                }
+                catch(...) {
+                    cerr << endl << endl;
+                    ran = false;
+                }
 
-            cout << "Operations performed:  " << operations << endl;
-            cout << "Cells used:            " << abs(greatest_cell) +
-                    abs(lowest_cell) + 1 << " (" << lowest_cell << " : " <<
-                    greatest_cell << ")" << endl;
-            cout << "Shift operations:      " << left_shifts + right_shifts <<
-                    " (" << left_shifts << " left, " << right_shifts <<
-                    " right)" << endl;
+                cout.precision(3);
+                cout << "Version " << version << ":             ";
+                if(!ran)
+                    cout << "failed";
+                else {
+                    cout << run_time.count() << "s";
+                    if(last_time >= 0)
+                        cout << showpos << " (" << run_time.count() -
+                                last_time << "s, " << run_operations -
+                                last_operations << " operations)" <<
+                                noshowpos;
+                    last_time = run_time.count();
+                    last_operations = run_operations;
+                }
+                cout << ", " << changed_loops << " of " <<
+                        watched->top_level_loops <<
+                        " top-level loops parsed" << endl << endl;
 
-            // Calculate how long the program took to run, and the average
-            // number of operations performed per second
-            // TODO: Find a way to make these results more repeatable -- maybe
-            // also give feedback on which operators took the most time to
-            // complete, or a breakdown of which loops took the longest
-            auto end_time = chrono::system_clock::now();
-            chrono::duration<double> elapsed_time = end_time - start_time;
-            float time_in_seconds =  elapsed_time.count() *
-                    chrono::seconds::period::num /
-                    chrono::seconds::period::den;
-            cout.precision(3);
-            cout << "Time taken:            " << time_in_seconds << "s" << endl;
-            cout << "Operations per second: " << operations / time_in_seconds <<
-                    endl << endl;
+                // A version which doesn't parse is skipped
+                while(true) {
+                    watched->wait();
+                    try {
+                        changed_loops = watched->reload(instructions,
+                                program);
+                        break;
+                    }
+                    catch(...) {
+                        cerr << endl << endl;
+                    }
+                }
+                operator_count = count_operators(instructions);
+                parallel = instructions.size() > (1 << 20);
+            }
         }
     }
     catch(...) {
 
         // Add some buffering after any error messages
         cerr << endl << endl;
-        return -1;
+        exit_code = -1;
     }
 
-    return 0;
+    cout.flush();
+    output_buffer.set_ring(nullptr);
+    output_ring.reset();
+    cout.rdbuf(standard_buffer);
+    return exit_code;
 }